@@ -0,0 +1,146 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Compares decoding a generated inotify stream into path_monitor_event
+// objects with decoding it into columnar event_batch objects the way
+// path_monitor_impl::consume_batch() does, each followed by a scan counting
+// the modified events of one directory by comparing directory names.
+//
+// Usage: batch [megabytes]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "path_monitor/event_batch.hpp"
+#include "path_monitor/inotify/inotify_parser.hpp"
+
+namespace {
+
+constexpr std::size_t read_size = 4096;
+constexpr int directories = 16;
+
+std::string generate(std::size_t bytes)
+{
+	std::mt19937 rng(1);
+	std::string stream;
+
+	while (stream.size() < bytes) {
+		std::size_t name = 4 + rng() % 28;
+		std::size_t len = (name + sizeof(inotify_event)) & ~(sizeof(inotify_event) - 1);
+		inotify_event iev = {};
+
+		iev.wd = 1 + rng() % directories;
+		iev.mask = rng() % 4 ? IN_MODIFY : IN_CREATE;
+		iev.len = len;
+
+		stream.append(reinterpret_cast<const char*>(&iev), sizeof(iev));
+		stream.append(name, 'f');
+		stream.append(len - name, '\0');
+	}
+
+	return stream;
+}
+
+services::path_monitor_event::type event_type(std::uint32_t mask)
+{
+	return mask & IN_MODIFY ? services::path_monitor_event::type::modified : services::path_monitor_event::type::added;
+}
+
+void report(const char *name, std::size_t records, std::size_t matches, std::chrono::steady_clock::time_point start)
+{
+	auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::printf("%-8s %zu records %zu matches %.3f s %.1f M records/s\n",
+		    name, records, matches, seconds, records / seconds / 1e6);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	std::size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+	auto stream = generate(megabytes * 1024 * 1024);
+
+	std::vector<std::string> paths;
+
+	for (int i = 0; i <= directories; ++i)
+		paths.push_back("/srv/build/output/directory" + std::to_string(i));
+
+	const std::string &target = paths[3];
+	auto now = std::chrono::steady_clock::now();
+
+	{
+		services::inotify_parser parser;
+		std::vector<services::path_monitor_event> events;
+		std::size_t records = 0;
+		std::size_t matches = 0;
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (std::size_t offset = 0; offset < stream.size(); offset += read_size) {
+			events.clear();
+			parser.parse(stream.data() + offset, std::min(read_size, stream.size() - offset),
+				     [&](const services::inotify_record_view &r) {
+					     services::path_monitor_event ev(paths[r.wd], r.name, event_type(r.mask));
+
+					     ev.cookie = r.cookie;
+					     ev.time = now;
+					     events.push_back(std::move(ev));
+				     });
+
+			for (const auto &ev : events)
+				matches += ev.event == services::path_monitor_event::type::modified and ev.parent_path.native() == target;
+
+			records += events.size();
+		}
+
+		report("events", records, matches, start);
+	}
+
+	{
+		services::inotify_parser parser;
+		services::event_batch batch;
+		std::size_t records = 0;
+		std::size_t matches = 0;
+		auto time = now.time_since_epoch().count();
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (std::size_t offset = 0; offset < stream.size(); offset += read_size) {
+			int last_wd = -1;
+
+			batch.clear();
+			parser.parse(stream.data() + offset, std::min(read_size, stream.size() - offset),
+				     [&](const services::inotify_record_view &r) {
+					     // Resolve each watch once per batch.
+					     if (r.wd != last_wd and batch.watch_path(r.wd).empty())
+						     batch.watch_paths.emplace_back(r.wd, paths[r.wd]);
+
+					     last_wd = r.wd;
+					     batch.push_back(event_type(r.mask), false, r.wd, r.cookie, time, r.name);
+				     });
+
+			auto modified = static_cast<std::uint8_t>(services::path_monitor_event::type::modified);
+			std::size_t n = batch.size();
+			const auto *types = batch.types.data();
+			const auto *watches = batch.watches.data();
+
+			for (std::size_t i = 0; i < n; ++i)
+				matches += types[i] == modified and batch.watch_path(watches[i]) == target;
+
+			records += n;
+		}
+
+		report("columnar", records, matches, start);
+	}
+
+	return 0;
+}
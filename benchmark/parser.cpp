@@ -0,0 +1,64 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Measures inotify_parser throughput on a generated stream of records with
+// names of typical length, fed in reads of the given size so that records
+// straddle reads.
+//
+// Usage: parser_benchmark [read size] [megabytes]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "path_monitor/inotify/inotify_parser.hpp"
+
+int main(int argc, char *argv[])
+{
+	std::size_t read_size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+	std::size_t megabytes = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 256;
+
+	std::mt19937 rng(1);
+	std::string stream;
+
+	while (stream.size() < megabytes * 1024 * 1024) {
+		std::size_t name = 4 + rng() % 28;
+		std::size_t len = (name + sizeof(inotify_event)) & ~(sizeof(inotify_event) - 1);
+		inotify_event iev = {};
+
+		iev.wd = 1 + rng() % 16;
+		iev.mask = IN_MODIFY;
+		iev.len = len;
+
+		stream.append(reinterpret_cast<const char*>(&iev), sizeof(iev));
+		stream.append(name, 'f');
+		stream.append(len - name, '\0');
+	}
+
+	services::inotify_parser parser;
+	std::size_t records = 0;
+	std::size_t name_bytes = 0;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t offset = 0; offset < stream.size(); offset += read_size) {
+		parser.parse(stream.data() + offset, std::min(read_size, stream.size() - offset),
+			     [&](const services::inotify_record_view &r) {
+				     ++records;
+				     name_bytes += r.name.size();
+			     });
+	}
+
+	auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::printf("%zu bytes %zu records (%zu name bytes) %.3f s %.2f GB/s %.1f M records/s\n",
+		    stream.size(), records, name_bytes, seconds, stream.size() / seconds / 1e9, records / seconds / 1e6);
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Compares the epoll and io_uring read paths: a number of monitors each watch
+// a directory in which files are created and removed, and the time until
+// every event has been consumed is reported.
+//
+// Usage: read_path [monitors] [files per monitor]
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "path_monitor/path_monitor.hpp"
+
+namespace {
+
+struct result
+{
+	double seconds;
+	std::size_t events;
+};
+
+result run(bool io_uring, std::size_t monitors, std::size_t files)
+{
+	boost::asio::io_context io_context;
+	std::system_error se;
+
+	if (io_uring) {
+		boost::asio::use_service<services::path_monitor_service<>>(io_context).enable_io_uring(se);
+
+		if (se.code()) {
+			std::fprintf(stderr, "io_uring: %s\n", se.what());
+			std::exit(1);
+		}
+	}
+
+	auto root = std::filesystem::temp_directory_path() / "path_monitor_read_path";
+
+	std::filesystem::remove_all(root);
+
+	std::vector<std::unique_ptr<services::path_monitor>> pms;
+	std::vector<std::filesystem::path> dirs;
+
+	for (std::size_t i = 0; i < monitors; ++i) {
+		dirs.push_back(root / std::to_string(i));
+		std::filesystem::create_directories(dirs.back());
+
+		pms.push_back(std::make_unique<services::path_monitor>(io_context, "Benchmark"));
+		pms.back()->add_path(dirs.back(), se);
+	}
+
+	// Each file produces an added and a removed event.
+	std::size_t expected = files * 2;
+	std::atomic<std::size_t> consumed{0};
+	std::vector<std::thread> consumers;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto &pm : pms) {
+		consumers.emplace_back([&pm, &consumed, expected]() {
+			std::system_error se;
+
+			for (std::size_t n = 0; n < expected; ++n) {
+				pm->monitor(se);
+				++consumed;
+			}
+		});
+	}
+
+	for (std::size_t f = 0; f < files; ++f) {
+		for (const auto &dir : dirs) {
+			auto file = dir / ("f" + std::to_string(f));
+
+			std::ofstream(file).put('x');
+			std::filesystem::remove(file);
+		}
+	}
+
+	for (auto &t : consumers)
+		t.join();
+
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+	pms.clear();
+	std::filesystem::remove_all(root);
+
+	return result{ elapsed.count(), consumed.load() };
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	std::size_t monitors = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 32;
+	std::size_t files = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+
+	for (bool io_uring : { false, true }) {
+		auto r = run(io_uring, monitors, files);
+
+		std::printf("%-8s %zu monitors %zu events %.3f s %.0f events/s\n",
+			    io_uring ? "io_uring" : "epoll", monitors, r.events, r.seconds, r.events / r.seconds);
+	}
+
+	return 0;
+}
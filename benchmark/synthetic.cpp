@@ -0,0 +1,48 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Measures the queueing and dispatch layers with the synthetic backend: one
+// thread generates events while another consumes them with monitor().
+//
+// Usage: synthetic_benchmark [events] [queue limit]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "path_monitor/synthetic/synthetic_path_monitor_impl.hpp"
+
+int main(int argc, char *argv[])
+{
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000000;
+	std::size_t limit = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 65536;
+
+	boost::asio::io_context io_context;
+	services::synthetic_path_monitor pm(io_context, "Benchmark");
+
+	pm.get_implementation()->set_queue_limit(limit);
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::thread producer([&pm, count]() {
+		pm.get_implementation()->generate(services::synthetic_event_generator(1), count);
+	});
+
+	std::system_error se;
+
+	for (std::size_t i = 0; i < count; ++i)
+		pm.monitor(se);
+
+	auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	producer.join();
+
+	std::printf("%zu events %.3f s %.2f M events/s\n", count, seconds, count / seconds / 1e6);
+
+	return 0;
+}
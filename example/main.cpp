@@ -41,6 +41,10 @@ void handler(const std::system_error &se, const services::path_monitor_event &t)
 		case services::path_monitor_event::type::renamed_new_name:
 			std::cout << "renamed_new_name";
 			break;
+
+		case services::path_monitor_event::type::ready:
+			std::cout << "ready";
+			break;
 	}
 
 	std::cout << " parent path: " << t.parent_path << " path: " << t.path << std::endl;
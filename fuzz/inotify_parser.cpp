@@ -0,0 +1,170 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Fuzz target for inotify_parser. The first input byte selects how the rest
+// is split into reads; the records decoded must not depend on the split and
+// every name must lie within the input.
+//
+// Built without libFuzzer, main() feeds generated streams of valid records,
+// split and truncated at random, and random bytes.
+//
+// Usage: inotify_parser_fuzz [iterations]
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "path_monitor/inotify/inotify_parser.hpp"
+
+namespace {
+
+struct decoded
+{
+	int wd;
+	std::uint32_t mask;
+	std::uint32_t cookie;
+	std::string name;
+
+	bool operator!=(const decoded &d) const
+	{
+		return wd != d.wd or mask != d.mask or cookie != d.cookie or name != d.name;
+	}
+};
+
+/// Parse data in reads of the given sizes, cycling through them.
+bool parse(const std::uint8_t *data, std::size_t size, const std::vector<std::size_t> &reads,
+	   std::vector<decoded> &records)
+{
+	services::inotify_parser parser;
+	auto begin = reinterpret_cast<const char*>(data);
+	std::size_t offset = 0;
+
+	for (std::size_t i = 0; offset < size; ++i) {
+		std::size_t n = std::min(reads[i % reads.size()], size - offset);
+
+		bool ok = parser.parse(begin + offset, n, [&](const services::inotify_record_view &r) {
+			if (r.name.size() > services::inotify_parser::max_record_size)
+				std::abort();
+
+			records.push_back(decoded{ r.wd, r.mask, r.cookie, std::string(r.name) });
+		});
+
+		if (!ok)
+			return false;
+
+		offset += n;
+	}
+
+	return true;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data, std::size_t size)
+{
+	if (!size)
+		return 0;
+
+	std::vector<std::size_t> whole = { size };
+	std::vector<std::size_t> split = { std::size_t(data[0]) + 1, 1, 7, 4096 };
+	std::vector<decoded> expected;
+	std::vector<decoded> records;
+
+	bool ok = parse(data + 1, size - 1, whole, expected);
+
+	// A corrupt record ends the stream at a point that depends on how much
+	// was read before it; only a clean stream must decode identically.
+	if (parse(data + 1, size - 1, split, records) != ok)
+		std::abort();
+
+	if (ok) {
+		if (records.size() != expected.size())
+			std::abort();
+
+		for (std::size_t i = 0; i < records.size(); ++i) {
+			if (records[i] != expected[i])
+				std::abort();
+		}
+	}
+
+	return 0;
+}
+
+#ifdef PATH_MONITOR_FUZZ_DRIVER
+
+namespace {
+
+std::string generate(std::mt19937 &rng)
+{
+	std::string stream(1, char(rng()));
+	std::size_t count = rng() % 64;
+
+	for (std::size_t i = 0; i < count; ++i) {
+		std::size_t name = rng() % 4 ? rng() % (NAME_MAX + 1) : 0;
+		std::size_t len = name ? (name + sizeof(inotify_event)) & ~(sizeof(inotify_event) - 1) : 0;
+		inotify_event iev = {};
+
+		iev.wd = rng();
+		iev.mask = rng();
+		iev.cookie = rng();
+		iev.len = len;
+
+		stream.append(reinterpret_cast<const char*>(&iev), sizeof(iev));
+
+		for (std::size_t c = 0; c < name; ++c)
+			stream.push_back('a' + rng() % 26);
+
+		stream.append(len - name, '\0');
+	}
+
+	switch (rng() % 4) {
+		case 0:
+			// Truncated inside the last record.
+			if (stream.size() > 1)
+				stream.resize(1 + rng() % (stream.size() - 1));
+			break;
+
+		case 1:
+			// Corrupted byte.
+			if (stream.size() > 1)
+				stream[1 + rng() % (stream.size() - 1)] = char(rng());
+			break;
+
+		case 2:
+			// Random bytes.
+			stream.resize(rng() % 2048);
+
+			for (auto &c : stream)
+				c = char(rng());
+			break;
+	}
+
+	return stream;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	std::size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+	std::mt19937 rng(1);
+
+	for (std::size_t i = 0; i < iterations; ++i) {
+		auto stream = generate(rng);
+
+		LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(stream.data()), stream.size());
+	}
+
+	std::printf("%zu inputs\n", iterations);
+
+	return 0;
+}
+
+#endif
@@ -12,13 +12,33 @@
 #ifndef SERVICES_BASIC_PATH_MONITOR_HPP
 #define SERVICES_BASIC_PATH_MONITOR_HPP
 
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <system_error>
+#include <vector>
 
 #define BOOST_ERROR_CODE_HEADER_ONLY
 #include <boost/asio/io_context.hpp>
 
+#include "path_metadata.hpp"
+
 namespace services {
 
+/// Result of a successful operation. Assigning it shares its message where
+/// constructing a std::system_error allocates one, which matters on paths
+/// taken for every event.
+inline const std::system_error& operation_succeeded()
+{
+	static const std::system_error se{ std::error_code() };
+
+	return se;
+}
+
 struct path_monitor_event
 {
 	enum class type
@@ -28,7 +48,8 @@ struct path_monitor_event
 		removed = 2,
 		modified = 3,
 		renamed_old_name = 4,
-		renamed_new_name = 5
+		renamed_new_name = 5,
+		ready = 6		// File complete, see watch_options::ready.
 	};
 
 	path_monitor_event() {}
@@ -39,6 +60,155 @@ struct path_monitor_event
 	std::filesystem::path parent_path;	// Facilitates filtering events for a particular directory in handler.
 	std::filesystem::path path;		// Path.
 	type event = type::null;
+
+	/// Bytes appended to the file, for modified events of tailed paths and
+	/// for the last bytes of a tailed file renamed away. Shared by all copies
+	/// of the event.
+	std::shared_ptr<const std::string> data;
+	std::uint64_t offset = 0;		// Position of data in the file.
+
+	bool is_directory = false;		// From the kernel, no stat needed.
+
+	/// Identifier of the file that survives renames and moves between paths
+	/// watched with watch_options::identity, zero if not tracked.
+	std::uint64_t file_id = 0;
+
+	/// Equal for the renamed_old_name and renamed_new_name events of one
+	/// rename, zero for other events.
+	std::uint32_t cookie = 0;
+
+	std::chrono::steady_clock::time_point time;	// When the monitor read the event.
+	std::shared_ptr<path_metadata_cache> metadata_cache;
+
+	/// Return the metadata of parent_path / path, fetched on first use and
+	/// shared with the other events of the monitor read before the fetch.
+	path_metadata metadata(std::error_code &ec) const
+	{
+		if (metadata_cache)
+			return metadata_cache->lookup(parent_path, path, time, ec);
+
+		path_metadata m;
+
+		path_metadata_cache::fetch(AT_FDCWD, (parent_path / path).c_str(), m, ec);
+
+		return m;
+	}
+};
+
+/// Dispatch priority of the events of a watched path.
+enum class watch_priority
+{
+	low = 0,
+	normal = 1,
+	high = 2
+};
+
+/// Options of a watched path.
+struct watch_options
+{
+	/// Events of high priority paths are dispatched ahead of queued events
+	/// of lower priority ones, which are still served now and then.
+	watch_priority priority = watch_priority::normal;
+
+	/// Deliver the bytes appended to files with their modified events. Files
+	/// are followed from their size when the path is added, from the start
+	/// when created and from the start again when truncated. Modified
+	/// events that add no bytes are dropped.
+	bool tail = false;
+
+	/// Assign events of the path a path_monitor_event::file_id. Files are
+	/// examined when they appear, one statx() shared with metadata().
+	bool identity = false;
+
+	/// Report a ready event once a file is complete: closed after writing,
+	/// moved in, or left open without writes for settle. Zero settle only
+	/// trusts closes and moves.
+	bool ready = false;
+	std::chrono::steady_clock::duration settle = std::chrono::seconds(1);
+
+	/// Also watch the subdirectories of the path, present and future, with
+	/// these options.
+	bool recursive = false;
+
+	/// Subdirectories of a recursive path left unwatched along with their
+	/// subtrees, as fnmatch() patterns. A pattern with a slash matches the
+	/// path relative to the watched one, such as "src/generated", any
+	/// other the directory name, such as "node_modules" or ".*".
+	std::vector<std::string> exclude;
+
+	/// Keep a listing of the directory, and of its subdirectories for a
+	/// recursive path, current from its events; read it with
+	/// basic_path_monitor::list_directory().
+	bool index = false;
+};
+
+/// Counters describing the state of a path monitor.
+struct path_monitor_stats
+{
+	std::size_t watches = 0;		// Paths watched with inotify.
+	std::size_t polled_watches = 0;		// Directories demoted to polling.
+	std::size_t evictions = 0;		// Demotions to polling so far.
+	std::size_t promotions = 0;		// Promotions back to inotify so far.
+	std::size_t queued_events = 0;
+
+	static constexpr std::size_t lane_count = 3;
+
+	/// Queued events by watch_priority, lowest first.
+	std::array<std::size_t, lane_count> queued_by_priority = {};
+};
+
+/// Interface for stages that observe every event a path monitor queues, in
+/// queue order. consume() is called from the monitor's reader thread and
+/// must not block.
+class path_monitor_event_sink
+{
+public:
+	virtual ~path_monitor_event_sink() = default;
+
+	virtual void consume(const path_monitor_event &ev) = 0;
+};
+
+class event_batch_sink;
+struct directory_listing;
+
+/// Handle of a subscription made with basic_path_monitor::subscribe().
+/// Copies refer to the same subscription; dropping them does not cancel it.
+class path_monitor_subscription
+{
+public:
+	/// What a service keeps for a subscription.
+	class state
+	{
+	public:
+		virtual ~state() = default;
+
+		virtual void cancel() = 0;
+		virtual bool active() const = 0;
+	};
+
+	path_monitor_subscription() = default;
+
+	explicit path_monitor_subscription(std::shared_ptr<state> s)
+		: m_state(std::move(s))
+	{
+	}
+
+	/// Stop delivering events. The handler is called a last time with
+	/// std::errc::operation_canceled; events it did not receive stay queued.
+	void cancel()
+	{
+		if (m_state)
+			m_state->cancel();
+	}
+
+	/// Return true until the handler was called for the last time.
+	bool active() const
+	{
+		return m_state and m_state->active();
+	}
+
+private:
+	std::shared_ptr<state> m_state;
 };
 
 /// Class to provide simple logging functionality. Use the services::logger
@@ -60,11 +230,15 @@ public:
 	* @param io_context The io_context object used to locate the logger service.
 	*
 	* @param identifier An identifier for this logger.
+	*
+	* @param resource Memory resource for the event queue and read buffers. It
+	* must outlive the monitor.
 	*/
-	explicit basic_path_monitor(boost::asio::io_context &io_context, const std::string &identifier)
+	explicit basic_path_monitor(boost::asio::io_context &io_context, const std::string &identifier,
+				    std::pmr::memory_resource *resource = std::pmr::get_default_resource())
 		: m_service(boost::asio::use_service<Service>(io_context))
 	{
-		m_service.create(m_impl, identifier);
+		m_service.create(m_impl, identifier, resource);
 	}
 
 	basic_path_monitor(basic_path_monitor &&) noexcept;		// Movable.
@@ -89,6 +263,13 @@ public:
 		return m_service.identifier(m_impl);
 	}
 
+	/// Get the underlying implementation, such as a
+	/// synthetic_path_monitor_impl to inject events into.
+	impl_type &get_implementation()
+	{
+		return m_impl;
+	}
+
 	/// Get the io_context associated with the object.
 	boost::asio::io_context &get_io_context()
 	{
@@ -98,7 +279,13 @@ public:
 	/// Add path to monitor.
 	void add_path(const std::filesystem::path &path, std::system_error &se)
 	{
-		m_service.add_path(m_impl, path, se);
+		m_service.add_path(m_impl, path, watch_options(), se);
+	}
+
+	/// Add path to monitor with options.
+	void add_path(const std::filesystem::path &path, const watch_options &options, std::system_error &se)
+	{
+		m_service.add_path(m_impl, path, options, se);
 	}
 
 	/// Remove path from monitor.
@@ -107,6 +294,78 @@ public:
 		m_service.remove_path(m_impl, path, se);
 	}
 
+	/// Save a snapshot of the watched directories (inode, size, mtime, name)
+	/// to file.
+	void save_snapshot(const std::filesystem::path &file, std::system_error &se)
+	{
+		m_service.save_snapshot(m_impl, file, se);
+	}
+
+	/// Diff a snapshot saved by a previous run against the watched directories
+	/// and queue the missed events ahead of live ones. Call after add_path().
+	void restore_snapshot(const std::filesystem::path &file, std::system_error &se)
+	{
+		m_service.restore_snapshot(m_impl, file, se);
+	}
+
+	/// Save a snapshot to file when the monitor stops and, if interval is
+	/// non-zero, periodically.
+	void set_snapshot(const std::filesystem::path &file, std::chrono::steady_clock::duration interval,
+			  std::system_error &se)
+	{
+		m_service.set_snapshot(m_impl, file, interval, se);
+	}
+
+	/// Limit the number of inotify watches. Beyond the budget, and whenever
+	/// the kernel's max_user_watches is exhausted, the least recently active
+	/// directories are polled every poll_interval instead and promoted back
+	/// when they change. Zero removes the limit.
+	void set_watch_budget(std::size_t max_watches, std::chrono::steady_clock::duration poll_interval,
+			      std::system_error &se)
+	{
+		m_service.set_watch_budget(m_impl, max_watches, poll_interval, se);
+	}
+
+	/// Return counters describing the monitor.
+	path_monitor_stats stats()
+	{
+		return m_service.stats(m_impl);
+	}
+
+	/// Attach a stage that observes every queued event, such as an
+	/// event_journal.
+	void add_sink(std::shared_ptr<path_monitor_event_sink> sink)
+	{
+		m_service.add_sink(m_impl, sink);
+	}
+
+	/// Detach a stage added with add_sink().
+	void remove_sink(std::shared_ptr<path_monitor_event_sink> sink)
+	{
+		m_service.remove_sink(m_impl, sink);
+	}
+
+	/// Deliver events to sink in columnar batches decoded straight from
+	/// each read instead of queueing them, for consumers scanning many
+	/// events at once; null restores queueing. Per-event features such as
+	/// tailing do not apply to batches. Sinks added with add_sink(), and
+	/// with them journals, rings, daemons and async_wait_quiet(), still
+	/// observe every event, decoded from the batch at the cost of an event
+	/// object per event.
+	void set_batch_sink(std::shared_ptr<event_batch_sink> sink, std::system_error &se)
+	{
+		m_service.set_batch_sink(m_impl, sink, se);
+	}
+
+	/// Return the entries of a directory of a path added with
+	/// watch_options::index, as of the last read of the kernel's queue.
+	/// Fails with std::errc::no_such_file_or_directory if the directory is
+	/// not indexed.
+	std::shared_ptr<const directory_listing> list_directory(const std::filesystem::path &dir, std::system_error &se)
+	{
+		return m_service.list_directory(m_impl, dir, se);
+	}
+
 	/// Monitor path events synchronously.
 	path_monitor_event monitor(std::system_error &se)
 	{
@@ -119,6 +378,30 @@ public:
 		m_service.async_monitor(m_impl, handler);
 	}
 
+	/// Call handler(const std::system_error &) once path and the paths below
+	/// it have had no event for quiet, such as a tree a build stopped
+	/// writing. Waits on one path share a timer that events never touch.
+	/// Handlers run on the io_context the monitor was created with; stop()
+	/// completes pending waits with std::errc::operation_canceled.
+	template <typename Handler>
+	void async_wait_quiet(const std::filesystem::path &path, std::chrono::steady_clock::duration quiet,
+			      Handler handler)
+	{
+		m_service.async_wait_quiet(m_impl, path, quiet, std::move(handler));
+	}
+
+	/// Call handler(const std::system_error &, path_monitor_event &&) for
+	/// every event until the subscription is cancelled or the monitor
+	/// stops, without an operation per event. Handlers run one at a time
+	/// like those of async_monitor(); the last call reports
+	/// std::errc::operation_canceled. A monitor has one subscription at a
+	/// time.
+	template <typename Handler>
+	path_monitor_subscription subscribe(Handler handler)
+	{
+		return m_service.subscribe(m_impl, std::move(handler));
+	}
+
 private:
 	/// The backend service implementation.
 	service_type &m_service;
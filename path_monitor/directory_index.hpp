@@ -0,0 +1,300 @@
+//
+// directory_index.hpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_DIRECTORY_INDEX_HPP
+#define SERVICES_DIRECTORY_INDEX_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "basic_path_monitor.hpp"
+
+namespace services {
+
+/// Entries of an indexed directory at one point in time, sorted by name.
+struct directory_listing
+{
+	struct entry
+	{
+		std::string name;
+		bool is_directory = false;
+	};
+
+	std::vector<entry> entries;
+
+	/// Return the entry named name, null if there is none.
+	const entry* find(std::string_view name) const
+	{
+		auto it = std::lower_bound(entries.begin(), entries.end(), name,
+					   [](const entry &e, std::string_view n) { return e.name < n; });
+
+		return it != entries.end() and it->name == name ? &*it : nullptr;
+	}
+};
+
+/// Listings of watched directories kept current from their events, so that
+/// asking what a directory holds costs a lookup instead of a readdir().
+/// Every directory has a slot holding an immutable listing, replaced with an
+/// atomic store. The writer copies a listing the first time a read of the
+/// kernel's queue changes it, applies that read's events to the copy and
+/// stores it at the end of the read, so a change costs the size of the
+/// directories it touched. Readers only share a lock with the writer while
+/// directories are added or removed. Directories are scanned again after
+/// the kernel dropped events.
+class directory_index
+{
+public:
+	directory_index() = default;
+
+	directory_index(const directory_index &) = delete;
+	directory_index& operator=(const directory_index &) = delete;
+
+	/// Index directories from scans.
+	void seed(const std::vector<std::string> &dirs)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		// Scanning under the writer's lock orders the scans before the
+		// events read meanwhile, which then apply to them.
+		std::vector<std::pair<const std::string*, std::shared_ptr<const directory_listing>>> scanned;
+
+		for (const auto &dir : dirs) {
+			if (auto listing = scan(dir))
+				scanned.emplace_back(&dir, std::move(listing));
+		}
+
+		std::unique_lock<std::shared_mutex> table_lk(m_table_mutex);
+
+		for (auto &d : scanned) {
+			auto &s = m_slots[*d.first];
+
+			if (!s)
+				s = std::make_shared<slot>();
+
+			m_pending.erase(*d.first);
+			std::atomic_store(&s->listing, std::move(d.second));
+		}
+	}
+
+	/// Stop indexing a directory and the directories below it.
+	void forget(const std::string &dir)
+	{
+		if (dir.empty())
+			return;
+
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		forget_locked(dir);
+	}
+
+	/// Apply an event of an indexed directory; published by publish().
+	void apply(const path_monitor_event &ev)
+	{
+		if (ev.path.empty())
+			return;
+
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto *entries = pending(ev.parent_path.native());
+
+		if (!entries)
+			return;
+
+		auto name = ev.path.native();
+		auto it = std::lower_bound(entries->begin(), entries->end(), name,
+					   [](const directory_listing::entry &e, const std::string &n) { return e.name < n; });
+		bool found = it != entries->end() and it->name == name;
+
+		switch (ev.event) {
+			case path_monitor_event::type::added:
+			case path_monitor_event::type::renamed_new_name:
+				if (found)
+					it->is_directory = ev.is_directory;
+				else
+					entries->insert(it, directory_listing::entry{ name, ev.is_directory });
+
+				break;
+
+			case path_monitor_event::type::removed:
+			case path_monitor_event::type::renamed_old_name:
+				if (found)
+					entries->erase(it);
+
+				// A directory that went away takes its listings along.
+				if (ev.is_directory)
+					forget_locked(ev.parent_path.native() + "/" + name);
+
+				break;
+
+			default:
+				break;
+		}
+
+		m_dirty = true;
+	}
+
+	/// Rescan every indexed directory at the next publish(), after the
+	/// kernel's queue overflowed.
+	void invalidate()
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		m_resync = true;
+		m_dirty = true;
+	}
+
+	/// Make the changes applied since the last call visible to readers.
+	void publish()
+	{
+		if (!m_dirty.load(std::memory_order_relaxed))
+			return;
+
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		for (auto &p : m_pending) {
+			auto listing = std::make_shared<directory_listing>();
+
+			listing->entries = std::move(p.second.entries);
+			std::atomic_store(&p.second.target->listing, std::shared_ptr<const directory_listing>(std::move(listing)));
+		}
+
+		// The table only changes under m_mutex, held here.
+		if (m_resync) {
+			for (auto &s : m_slots) {
+				if (auto listing = scan(s.first))
+					std::atomic_store(&s.second->listing, std::move(listing));
+			}
+		}
+
+		m_pending.clear();
+		m_resync = false;
+		m_dirty = false;
+	}
+
+	/// Return the listing of an indexed directory, null if not indexed.
+	std::shared_ptr<const directory_listing> list(std::string_view dir) const
+	{
+		std::shared_lock<std::shared_mutex> lk(m_table_mutex);
+
+		auto it = m_slots.find(dir);
+
+		return it == m_slots.end() ? nullptr : std::atomic_load(&it->second->listing);
+	}
+
+private:
+	struct slot
+	{
+		std::shared_ptr<const directory_listing> listing;	// Atomic access only.
+	};
+
+	/// Writer's copy of a listing changed by the current read.
+	struct pending_listing
+	{
+		std::shared_ptr<slot> target;
+		std::vector<directory_listing::entry> entries;
+	};
+
+	static std::shared_ptr<const directory_listing> scan(const std::string &dir)
+	{
+		DIR *d = ::opendir(dir.c_str());
+
+		if (!d)
+			return nullptr;
+
+		auto listing = std::make_shared<directory_listing>();
+
+		while (auto *e = ::readdir(d)) {
+			if (e->d_name[0] == '.' and (!e->d_name[1] or (e->d_name[1] == '.' and !e->d_name[2])))
+				continue;
+
+			bool is_directory = e->d_type == DT_DIR;
+
+			if (e->d_type == DT_UNKNOWN) {
+				struct stat st;
+
+				is_directory = ::fstatat(::dirfd(d), e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 and
+					       S_ISDIR(st.st_mode);
+			}
+
+			listing->entries.push_back(directory_listing::entry{ e->d_name, is_directory });
+		}
+
+		::closedir(d);
+
+		std::sort(listing->entries.begin(), listing->entries.end(),
+			  [](const auto &a, const auto &b) { return a.name < b.name; });
+
+		return listing;
+	}
+
+	template <typename Map>
+	static void erase_tree(Map &map, const std::string &dir)
+	{
+		map.erase(dir);
+
+		auto prefix = dir + "/";
+
+		for (auto it = map.lower_bound(prefix); it != map.end() and
+		     it->first.compare(0, prefix.size(), prefix) == 0;)
+			it = map.erase(it);
+	}
+
+	/// Forget a directory tree; m_mutex must be held.
+	void forget_locked(const std::string &dir)
+	{
+		erase_tree(m_pending, dir);
+
+		std::unique_lock<std::shared_mutex> lk(m_table_mutex);
+
+		erase_tree(m_slots, dir);
+	}
+
+	/// Return the writer's copy of a listing, null if not indexed.
+	std::vector<directory_listing::entry>* pending(const std::string &dir)
+	{
+		auto it = m_pending.find(dir);
+
+		if (it != m_pending.end())
+			return &it->second.entries;
+
+		auto s = m_slots.find(dir);
+
+		if (s == m_slots.end())
+			return nullptr;
+
+		auto listing = std::atomic_load(&s->second->listing);
+
+		return &m_pending.emplace(dir, pending_listing{ s->second, listing->entries }).first->second.entries;
+	}
+
+	std::mutex m_mutex;			// Writers only.
+	mutable std::shared_mutex m_table_mutex;	// Guards the shape of m_slots.
+	std::map<std::string, std::shared_ptr<slot>, std::less<>> m_slots;
+	std::map<std::string, pending_listing, std::less<>> m_pending;
+	bool m_resync = false;
+	std::atomic<bool> m_dirty{ false };
+};
+
+} // namespace services
+
+#endif // SERVICES_DIRECTORY_INDEX_HPP
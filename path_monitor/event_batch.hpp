@@ -0,0 +1,123 @@
+//
+// event_batch.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_EVENT_BATCH_HPP
+#define SERVICES_EVENT_BATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "basic_path_monitor.hpp"
+
+namespace services {
+
+/// Events in struct-of-arrays form: column i of every array describes event
+/// i, and names are stored back to back in one blob. Scanning a column
+/// touches nothing else, so filters and counts over thousands of events
+/// vectorize. Clearing keeps the capacity; a reused batch stops allocating
+/// once it has held its largest read.
+struct event_batch
+{
+	std::vector<std::uint8_t> types;	// path_monitor_event::type.
+	std::vector<std::uint8_t> directories;	// Non-zero for directories.
+	std::vector<std::int32_t> watches;	// Watch of the parent directory.
+	std::vector<std::uint32_t> cookies;	// See path_monitor_event::cookie.
+	std::vector<std::int64_t> times;	// steady_clock nanoseconds.
+	std::vector<std::uint32_t> name_offsets{ 0 };	// size() + 1 entries.
+	std::string names;
+
+	/// Parent directory of each watch appearing in the batch.
+	std::vector<std::pair<std::int32_t, std::string>> watch_paths;
+
+	std::size_t size() const
+	{
+		return types.size();
+	}
+
+	bool empty() const
+	{
+		return types.empty();
+	}
+
+	void clear()
+	{
+		types.clear();
+		directories.clear();
+		watches.clear();
+		cookies.clear();
+		times.clear();
+		name_offsets.resize(1);
+		names.clear();
+		watch_paths.clear();
+	}
+
+	void push_back(path_monitor_event::type type, bool directory, std::int32_t watch, std::uint32_t cookie,
+		       std::int64_t time, std::string_view name)
+	{
+		types.push_back(static_cast<std::uint8_t>(type));
+		directories.push_back(directory);
+		watches.push_back(watch);
+		cookies.push_back(cookie);
+		times.push_back(time);
+		names.append(name);
+		name_offsets.push_back(names.size());
+	}
+
+	/// Name of event i, empty for the watched file itself.
+	std::string_view name(std::size_t i) const
+	{
+		return std::string_view(names).substr(name_offsets[i], name_offsets[i + 1] - name_offsets[i]);
+	}
+
+	/// Parent directory of the events of a watch, empty if unknown.
+	const std::string& watch_path(std::int32_t watch) const
+	{
+		static const std::string unknown;
+
+		for (const auto &w : watch_paths) {
+			if (w.first == watch)
+				return w.second;
+		}
+
+		return unknown;
+	}
+
+	/// Build the path_monitor_event of event i.
+	path_monitor_event event(std::size_t i) const
+	{
+		path_monitor_event ev(watch_path(watches[i]), std::string(name(i)),
+				      static_cast<path_monitor_event::type>(types[i]));
+
+		ev.is_directory = directories[i];
+		ev.cookie = cookies[i];
+		ev.time = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(times[i]));
+
+		return ev;
+	}
+};
+
+/// Consumer of the events of a monitor in columnar batches, one per read
+/// of the kernel's queue. consume() is called from the monitor's reader
+/// thread and must not block; the batch is reused once it returns.
+class event_batch_sink
+{
+public:
+	virtual ~event_batch_sink() = default;
+
+	virtual void consume(const event_batch &batch) = 0;
+};
+
+} // namespace services
+
+#endif // SERVICES_EVENT_BATCH_HPP
@@ -0,0 +1,695 @@
+//
+// event_journal.hpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_EVENT_JOURNAL_HPP
+#define SERVICES_EVENT_JOURNAL_HPP
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "basic_path_monitor.hpp"
+
+namespace services {
+
+/// On-disk layout of journal segments. A journal is a directory of fixed size
+/// segment files named after the sequence number of their first record.
+///
+/// [segment header][record][record]...
+///
+/// A record is committed by storing its size last; a zero size marks the end
+/// of the written part of a segment and end_of_segment marks a sealed one.
+/// Recycled segments are not cleared, stale records are recognised by their
+/// sequence number.
+namespace event_journal_format {
+
+constexpr char magic[8] = { 'P', 'M', 'J', 'R', 'N', 'L', '0', '1' };
+constexpr std::uint32_t end_of_segment = 0xFFFFFFFF;
+constexpr std::size_t alignment = 8;
+
+struct segment_header
+{
+	char magic[8];
+	std::uint64_t first_sequence;
+	char reserved[48];
+};
+
+struct record_header
+{
+	std::uint32_t size;
+	std::uint32_t type;
+	std::uint64_t sequence;
+	std::uint16_t parent_length;
+	std::uint16_t path_length;
+	std::uint32_t reserved;
+};
+
+inline std::size_t record_size(std::size_t parent_length, std::size_t path_length)
+{
+	return (sizeof(record_header) + parent_length + path_length + alignment - 1) & ~(alignment - 1);
+}
+
+inline std::string segment_name(std::uint64_t first_sequence)
+{
+	char name[32];
+
+	std::snprintf(name, sizeof(name), "%020llu.seg", static_cast<unsigned long long>(first_sequence));
+
+	return name;
+}
+
+/// Return the segments of a journal directory keyed by first sequence number.
+inline std::map<std::uint64_t, std::filesystem::path> list_segments(const std::filesystem::path &directory)
+{
+	std::map<std::uint64_t, std::filesystem::path> segments;
+	std::error_code ec;
+
+	for (const auto &entry : std::filesystem::directory_iterator(directory, ec)) {
+		if (entry.path().extension() != ".seg")
+			continue;
+
+		// Skip stray files whose name is not a sequence number.
+		auto stem = entry.path().stem().string();
+		std::uint64_t first_sequence;
+		auto [end, error] = std::from_chars(stem.data(), stem.data() + stem.size(), first_sequence);
+
+		if (error != std::errc() or end != stem.data() + stem.size())
+			continue;
+
+		segments.emplace(first_sequence, entry.path());
+	}
+
+	return segments;
+}
+
+/// Memory mapped segment file.
+class mapped_segment
+{
+public:
+	mapped_segment() = default;
+
+	mapped_segment(const mapped_segment &) = delete;
+	mapped_segment& operator=(const mapped_segment &) = delete;
+
+	~mapped_segment()
+	{
+		unmap();
+	}
+
+	/// Map a segment, creating or resizing it to size when writable.
+	bool map(const std::filesystem::path &file, std::size_t size, bool writable, std::error_code &ec)
+	{
+		unmap();
+
+		int fd = ::open(file.c_str(), (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644);
+
+		if (fd == -1) {
+			ec = std::error_code(errno, std::system_category());
+
+			return false;
+		}
+
+		struct stat st;
+
+		if (::fstat(fd, &st) == -1 or (writable and std::size_t(st.st_size) != size and ::ftruncate(fd, size) == -1)) {
+			ec = std::error_code(errno, std::system_category());
+			::close(fd);
+
+			return false;
+		}
+
+		m_size = writable ? size : st.st_size;
+
+		if (m_size < sizeof(segment_header)) {
+			ec = std::make_error_code(std::errc::invalid_argument);
+			m_size = 0;
+			::close(fd);
+
+			return false;
+		}
+
+		void *data = ::mmap(nullptr, m_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+		if (data == MAP_FAILED) {
+			ec = std::error_code(errno, std::system_category());
+			m_size = 0;
+			::close(fd);
+
+			return false;
+		}
+
+		::close(fd);
+
+		m_data = static_cast<char*>(data);
+
+		return true;
+	}
+
+	void unmap()
+	{
+		if (m_data)
+			::munmap(m_data, m_size);
+
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	void flush()
+	{
+		if (m_data)
+			::msync(m_data, m_size, MS_ASYNC);
+	}
+
+	segment_header *header() const
+	{
+		return reinterpret_cast<segment_header*>(m_data);
+	}
+
+	record_header *record(std::size_t offset) const
+	{
+		return reinterpret_cast<record_header*>(m_data + offset);
+	}
+
+	/// Return the committed size of the record at offset, zero if none.
+	std::uint32_t committed_size(std::size_t offset) const
+	{
+		if (offset + sizeof(record_header) > m_size)
+			return end_of_segment;
+
+		return __atomic_load_n(&record(offset)->size, __ATOMIC_ACQUIRE);
+	}
+
+	char *data() const
+	{
+		return m_data;
+	}
+
+	std::size_t size() const
+	{
+		return m_size;
+	}
+
+private:
+	char *m_data = nullptr;
+	std::size_t m_size = 0;
+};
+
+} // namespace event_journal_format
+
+/// Options controlling journal segment sizes and retention.
+struct event_journal_options
+{
+	/// Size of each segment file.
+	std::size_t segment_size = 16 * 1024 * 1024;
+
+	/// Number of segments kept when no consumer cursor holds them back.
+	std::size_t retained_segments = 4;
+
+	/// Most segments kept however far behind a cursor is, zero for no
+	/// limit. Without one, a cursor that never acknowledges, including one
+	/// still at its start, keeps every segment and the journal grows without
+	/// bound. A cursor behind the segments removed by the limit fails with
+	/// std::errc::result_out_of_range.
+	std::size_t max_segments = 0;
+};
+
+/// Durable, memory mapped, segmented journal of path monitor events. Attach
+/// it to a monitor with add_sink() to journal every queued event and read it
+/// back with event_journal_cursor, possibly from another process.
+class event_journal
+	: public path_monitor_event_sink
+{
+public:
+	event_journal(const std::filesystem::path &directory, event_journal_options options = event_journal_options())
+		: m_directory(directory),
+		m_options(options)
+	{
+		m_options.segment_size = std::max(m_options.segment_size, std::size_t(4096));
+
+		std::error_code ec;
+
+		std::filesystem::create_directories(m_directory, ec);
+
+		if (ec)
+			throw std::system_error(ec, "service::event_journal: creating \"" + m_directory.string() + "\" failed");
+
+		recover(ec);
+
+		if (ec)
+			throw std::system_error(ec, "service::event_journal: recovering \"" + m_directory.string() + "\" failed");
+	}
+
+	/// Append an event from the monitor's reader thread. Failures are
+	/// counted and reported by dropped().
+	void consume(const path_monitor_event &ev) override
+	{
+		std::system_error se;
+
+		append(ev, se);
+
+		if (se.code()) {
+			std::unique_lock<std::mutex> lk(m_mutex);
+
+			++m_dropped;
+			m_error = se;
+		}
+	}
+
+	/// Return the number of events consume() failed to append, with the
+	/// error of the last failure in se; se is clear if none failed.
+	std::uint64_t dropped(std::system_error &se)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		se = m_error;
+
+		return m_dropped;
+	}
+
+	/// Append an event and return its sequence number.
+	std::uint64_t append(const path_monitor_event &ev, std::system_error &se)
+	{
+		const auto &parent = ev.parent_path.native();
+		const auto &path = ev.path.native();
+
+		if (parent.size() > UINT16_MAX or path.size() > UINT16_MAX) {
+			se = std::system_error(std::make_error_code(std::errc::filename_too_long),
+					       "service::event_journal::append: path too long");
+
+			return 0;
+		}
+
+		auto size = event_journal_format::record_size(parent.size(), path.size());
+
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		// Keep room for the sealing marker after every record.
+		if (m_offset + size + sizeof(std::uint32_t) > m_segment.size()) {
+			std::error_code ec;
+
+			roll(ec);
+
+			if (ec) {
+				se = std::system_error(ec, "service::event_journal::append: rolling segment failed");
+
+				return 0;
+			}
+
+			if (m_offset + size + sizeof(std::uint32_t) > m_segment.size()) {
+				se = std::system_error(std::make_error_code(std::errc::file_too_large),
+						       "service::event_journal::append: record larger than a segment");
+
+				return 0;
+			}
+		}
+
+		auto *r = m_segment.record(m_offset);
+
+		__atomic_store_n(&r->size, 0, __ATOMIC_RELAXED);
+
+		r->type = static_cast<std::uint32_t>(ev.event);
+		r->sequence = m_next_sequence;
+		r->parent_length = parent.size();
+		r->path_length = path.size();
+		r->reserved = 0;
+
+		std::memcpy(reinterpret_cast<char*>(r + 1), parent.data(), parent.size());
+		std::memcpy(reinterpret_cast<char*>(r + 1) + parent.size(), path.data(), path.size());
+
+		// The next record slot may hold a stale record of a recycled segment.
+		if (m_offset + size + sizeof(event_journal_format::record_header) <= m_segment.size())
+			__atomic_store_n(&m_segment.record(m_offset + size)->size, 0, __ATOMIC_RELAXED);
+
+		__atomic_store_n(&r->size, static_cast<std::uint32_t>(size), __ATOMIC_RELEASE);
+
+		m_offset += size;
+
+		se = operation_succeeded();
+
+		return m_next_sequence++;
+	}
+
+	/// Schedule write back of the current segment.
+	void flush()
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		m_segment.flush();
+	}
+
+	/// Sequence number the next appended event will get.
+	std::uint64_t next_sequence()
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		return m_next_sequence;
+	}
+
+	const std::filesystem::path &directory() const
+	{
+		return m_directory;
+	}
+
+private:
+	/// Open the newest segment and find the end of its committed records.
+	void recover(std::error_code &ec)
+	{
+		auto segments = event_journal_format::list_segments(m_directory);
+
+		if (segments.empty()) {
+			open_segment(1, ec);
+
+			return;
+		}
+
+		auto last = std::prev(segments.end());
+
+		if (!m_segment.map(last->second, m_options.segment_size, true, ec))
+			return;
+
+		auto *h = m_segment.header();
+
+		// A crash between renaming a retired segment into place and writing
+		// its header leaves the header of its previous use, which cursors
+		// would reject; the name is authoritative.
+		if (std::memcmp(h->magic, event_journal_format::magic, sizeof(h->magic)) or h->first_sequence != last->first) {
+			std::memcpy(h->magic, event_journal_format::magic, sizeof(h->magic));
+			h->first_sequence = last->first;
+		}
+
+		m_first_sequence = last->first;
+		m_next_sequence = last->first;
+		m_offset = sizeof(event_journal_format::segment_header);
+
+		for (;;) {
+			auto size = m_segment.committed_size(m_offset);
+
+			if (size == 0 or size == event_journal_format::end_of_segment or
+			    m_segment.record(m_offset)->sequence != m_next_sequence)
+				break;
+
+			m_offset += size;
+			++m_next_sequence;
+		}
+
+		if (m_offset + sizeof(event_journal_format::record_header) <= m_segment.size())
+			__atomic_store_n(&m_segment.record(m_offset)->size, 0, __ATOMIC_RELEASE);
+	}
+
+	/// Seal the current segment and continue in a new one.
+	void roll(std::error_code &ec)
+	{
+		__atomic_store_n(&m_segment.record(m_offset)->size, event_journal_format::end_of_segment, __ATOMIC_RELEASE);
+		m_segment.flush();
+		m_segment.unmap();
+
+		open_segment(m_next_sequence, ec);
+	}
+
+	/// Start a segment at first_sequence, reusing a retired segment file when
+	/// one is available.
+	void open_segment(std::uint64_t first_sequence, std::error_code &ec)
+	{
+		auto file = m_directory / event_journal_format::segment_name(first_sequence);
+		auto retired = retire_segments(first_sequence);
+
+		if (!retired.empty())
+			std::filesystem::rename(retired, file, ec);
+
+		ec.clear();
+
+		if (!m_segment.map(file, m_options.segment_size, true, ec))
+			return;
+
+		auto *h = m_segment.header();
+
+		std::memcpy(h->magic, event_journal_format::magic, sizeof(h->magic));
+		h->first_sequence = first_sequence;
+
+		__atomic_store_n(&m_segment.record(sizeof(*h))->size, 0, __ATOMIC_RELEASE);
+
+		m_first_sequence = first_sequence;
+		m_next_sequence = first_sequence;
+		m_offset = sizeof(*h);
+	}
+
+	/// Remove segments that every cursor has acknowledged or that exceed the
+	/// retention limit, and those beyond max_segments whatever the cursors.
+	/// Returns one of them for reuse, if any.
+	std::filesystem::path retire_segments(std::uint64_t next_sequence)
+	{
+		auto segments = event_journal_format::list_segments(m_directory);
+		auto acknowledged = acknowledged_sequence(next_sequence);
+		std::filesystem::path reusable;
+
+		while (!segments.empty()) {
+			auto first = segments.begin();
+			auto second = std::next(first);
+
+			// A segment ends where the next one starts.
+			std::uint64_t end = second != segments.end() ? second->first : next_sequence;
+			bool held = acknowledged ? end > *acknowledged : segments.size() < m_options.retained_segments;
+
+			// Room is left for the segment being opened.
+			if (m_options.max_segments and segments.size() >= m_options.max_segments)
+				held = false;
+
+			if (held)
+				break;
+
+			std::error_code ec;
+
+			if (reusable.empty())
+				reusable = first->second;
+			else
+				std::filesystem::remove(first->second, ec);
+
+			segments.erase(first);
+		}
+
+		return reusable;
+	}
+
+	/// Lowest sequence number acknowledged by all cursors, if there are any.
+	std::optional<std::uint64_t> acknowledged_sequence(std::uint64_t next_sequence)
+	{
+		std::optional<std::uint64_t> acknowledged;
+		std::error_code ec;
+
+		for (const auto &entry : std::filesystem::directory_iterator(m_directory, ec)) {
+			if (entry.path().extension() != ".cursor")
+				continue;
+
+			std::uint64_t sequence = 0;
+			int fd = ::open(entry.path().c_str(), O_RDONLY | O_CLOEXEC);
+
+			if (fd != -1) {
+				if (::pread(fd, &sequence, sizeof(sequence), 0) != sizeof(sequence))
+					sequence = 0;
+
+				::close(fd);
+			}
+
+			acknowledged = std::min(acknowledged.value_or(next_sequence), sequence);
+		}
+
+		return acknowledged;
+	}
+
+	std::filesystem::path m_directory;
+	event_journal_options m_options;
+	std::mutex m_mutex;
+	event_journal_format::mapped_segment m_segment;
+	std::uint64_t m_first_sequence = 1;
+	std::uint64_t m_next_sequence = 1;
+	std::size_t m_offset = 0;
+	std::uint64_t m_dropped = 0;
+	std::system_error m_error{ std::error_code() };
+};
+
+/// Named, persistent read position in an event journal. Events are read in
+/// sequence order starting at any sequence number; acknowledge() records
+/// progress so that a restarted consumer resumes after the last acknowledged
+/// event and the journal may recycle segments behind it. Until then the
+/// cursor holds back every segment, bounded only by
+/// event_journal_options::max_segments.
+class event_journal_cursor
+{
+public:
+	event_journal_cursor(const std::filesystem::path &directory, const std::string &name)
+		: m_directory(directory),
+		m_fd(::open((directory / (name + ".cursor")).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644))
+	{
+		if (m_fd == -1) {
+			throw std::system_error(std::error_code(errno, std::system_category()),
+						"service::event_journal_cursor: opening cursor \"" + name + "\" failed");
+		}
+
+		std::uint64_t acknowledged = 0;
+
+		if (::pread(m_fd, &acknowledged, sizeof(acknowledged), 0) != sizeof(acknowledged))
+			acknowledged = 0;
+
+		m_next_sequence = std::max<std::uint64_t>(acknowledged, 1);
+	}
+
+	event_journal_cursor(const event_journal_cursor &) = delete;
+	event_journal_cursor& operator=(const event_journal_cursor &) = delete;
+
+	~event_journal_cursor()
+	{
+		::close(m_fd);
+	}
+
+	/// Position the cursor so that the next read returns sequence.
+	void seek(std::uint64_t sequence)
+	{
+		m_next_sequence = sequence;
+		m_segment.unmap();
+	}
+
+	/// Read the next event. Returns false and leaves se clear when the cursor
+	/// has caught up with the writer.
+	bool next(path_monitor_event &ev, std::uint64_t &sequence, std::system_error &se)
+	{
+		se = operation_succeeded();
+
+		if (!m_segment.data() and !locate(se))
+			return false;
+
+		for (;;) {
+			auto size = m_segment.committed_size(m_offset);
+
+			if (size == event_journal_format::end_of_segment) {
+				// Continue in the segment that starts where this one ended
+				// once the writer has created it.
+				if (!event_journal_format::list_segments(m_directory).count(m_next_sequence))
+					return false;
+
+				m_segment.unmap();
+
+				if (!locate(se))
+					return false;
+
+				continue;
+			}
+
+			const auto *r = m_segment.record(m_offset);
+
+			// Records of a recycled segment's previous life are stale.
+			if (size == 0 or size > m_segment.size() - m_offset or r->sequence > m_next_sequence or
+			    r->sequence < m_segment.header()->first_sequence)
+				return false;
+
+			m_offset += size;
+
+			if (r->sequence < m_next_sequence)
+				continue;
+
+			const char *names = reinterpret_cast<const char*>(r + 1);
+
+			if (sizeof(*r) + r->parent_length + r->path_length > size) {
+				se = std::system_error(std::make_error_code(std::errc::bad_message),
+						       "service::event_journal_cursor::next: corrupt record");
+
+				return false;
+			}
+
+			ev = path_monitor_event(std::string(names, r->parent_length),
+						std::string(names + r->parent_length, r->path_length),
+						static_cast<path_monitor_event::type>(r->type));
+			sequence = m_next_sequence++;
+
+			return true;
+		}
+	}
+
+	/// Record that every event before sequence has been processed.
+	void acknowledge(std::uint64_t sequence, std::system_error &se)
+	{
+		if (::pwrite(m_fd, &sequence, sizeof(sequence), 0) != sizeof(sequence)) {
+			se = std::system_error(std::error_code(errno, std::system_category()),
+					       "service::event_journal_cursor::acknowledge: pwrite failed");
+
+			return;
+		}
+
+		se = operation_succeeded();
+	}
+
+	/// Sequence number the next read returns.
+	std::uint64_t next_sequence() const
+	{
+		return m_next_sequence;
+	}
+
+private:
+	/// Map the segment holding the next sequence number.
+	bool locate(std::system_error &se)
+	{
+		auto segments = event_journal_format::list_segments(m_directory);
+		auto it = segments.upper_bound(m_next_sequence);
+
+		if (it == segments.begin()) {
+			if (!segments.empty() and m_next_sequence < segments.begin()->first) {
+				se = std::system_error(std::make_error_code(std::errc::result_out_of_range),
+						       "service::event_journal_cursor::next: events were recycled");
+			}
+
+			return false;
+		}
+
+		--it;
+
+		std::error_code ec;
+
+		if (!m_segment.map(it->second, 0, false, ec)) {
+			se = std::system_error(ec, "service::event_journal_cursor::next: mapping segment failed");
+
+			return false;
+		}
+
+		if (std::memcmp(m_segment.header()->magic, event_journal_format::magic, sizeof(event_journal_format::magic)) or
+		    m_segment.header()->first_sequence != it->first) {
+			m_segment.unmap();
+
+			return false;
+		}
+
+		m_offset = sizeof(event_journal_format::segment_header);
+
+		return true;
+	}
+
+	std::filesystem::path m_directory;
+	int m_fd;
+	event_journal_format::mapped_segment m_segment;
+	std::size_t m_offset = 0;
+	std::uint64_t m_next_sequence = 1;
+};
+
+} // namespace services
+
+#endif // SERVICES_EVENT_JOURNAL_HPP
@@ -0,0 +1,183 @@
+//
+// event_queue.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_EVENT_QUEUE_HPP
+#define SERVICES_EVENT_QUEUE_HPP
+
+#include <array>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <memory_resource>
+#include <vector>
+
+#include "basic_path_monitor.hpp"
+
+namespace services {
+
+/// Queue of events with one FIFO lane per watch_priority. Events are taken
+/// from the highest priority lane holding any, except that a lane passed
+/// over starvation_limit times is served next, so bulk events on a low
+/// priority path are delayed but never stalled. Not synchronized.
+class priority_event_queue
+{
+public:
+	static constexpr std::size_t lane_count = path_monitor_stats::lane_count;
+
+	explicit priority_event_queue(std::pmr::memory_resource *resource = std::pmr::get_default_resource(),
+				      std::size_t starvation_limit = 64)
+		: m_lanes{ lane_type(resource), lane_type(resource), lane_type(resource) },
+		m_starvation_limit(starvation_limit)
+	{
+	}
+
+	bool empty() const
+	{
+		return !m_size;
+	}
+
+	std::size_t size() const
+	{
+		return m_size;
+	}
+
+	/// Number of events queued in each lane, lowest priority first.
+	std::array<std::size_t, lane_count> depths() const
+	{
+		std::array<std::size_t, lane_count> d;
+
+		for (std::size_t i = 0; i < lane_count; ++i)
+			d[i] = m_lanes[i].size();
+
+		return d;
+	}
+
+	void push_back(path_monitor_event ev, watch_priority priority = watch_priority::normal)
+	{
+		m_lanes[static_cast<std::size_t>(priority)].push_back(std::move(ev));
+		++m_size;
+	}
+
+	/// Insert events ahead of those of their lane, preserving their order.
+	void push_front(std::vector<path_monitor_event> evs, watch_priority priority = watch_priority::normal)
+	{
+		auto &lane = m_lanes[static_cast<std::size_t>(priority)];
+
+		lane.insert(lane.begin(), std::make_move_iterator(evs.begin()), std::make_move_iterator(evs.end()));
+		m_size += evs.size();
+	}
+
+	/// Remove and return the next event; the queue must not be empty.
+	path_monitor_event pop_front()
+	{
+		std::size_t next = lane_count;
+
+		// A starved lane goes first, the lowest one if several are.
+		for (std::size_t i = 0; i < lane_count; ++i) {
+			if (!m_lanes[i].empty() and m_skipped[i] >= m_starvation_limit) {
+				next = i;
+
+				break;
+			}
+		}
+
+		if (next == lane_count) {
+			next = lane_count - 1;
+
+			while (m_lanes[next].empty())
+				--next;
+		}
+
+		// Count the pass over every waiting lane below the one served.
+		for (std::size_t i = 0; i < next; ++i) {
+			if (!m_lanes[i].empty())
+				++m_skipped[i];
+		}
+
+		m_skipped[next] = 0;
+
+		path_monitor_event ev = std::move(m_lanes[next].front());
+
+		m_lanes[next].pop_front();
+		--m_size;
+
+		return ev;
+	}
+
+private:
+	typedef std::pmr::deque<path_monitor_event> lane_type;
+
+	std::array<lane_type, lane_count> m_lanes;
+	std::array<std::size_t, lane_count> m_skipped = {};
+	std::size_t m_starvation_limit;
+	std::size_t m_size = 0;
+};
+
+/// Queue of events in arrival order regardless of priority, for monitors
+/// that do not weigh paths against each other. Interface of
+/// priority_event_queue; every event counts in the normal lane's depth.
+/// Not synchronized.
+class fifo_event_queue
+{
+public:
+	static constexpr std::size_t lane_count = path_monitor_stats::lane_count;
+
+	explicit fifo_event_queue(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+		: m_events(resource)
+	{
+	}
+
+	bool empty() const
+	{
+		return m_events.empty();
+	}
+
+	std::size_t size() const
+	{
+		return m_events.size();
+	}
+
+	std::array<std::size_t, lane_count> depths() const
+	{
+		std::array<std::size_t, lane_count> d = {};
+
+		d[static_cast<std::size_t>(watch_priority::normal)] = m_events.size();
+
+		return d;
+	}
+
+	void push_back(path_monitor_event ev, watch_priority = watch_priority::normal)
+	{
+		m_events.push_back(std::move(ev));
+	}
+
+	/// Insert events ahead of all others, preserving their order.
+	void push_front(std::vector<path_monitor_event> evs, watch_priority = watch_priority::normal)
+	{
+		m_events.insert(m_events.begin(), std::make_move_iterator(evs.begin()), std::make_move_iterator(evs.end()));
+	}
+
+	/// Remove and return the next event; the queue must not be empty.
+	path_monitor_event pop_front()
+	{
+		path_monitor_event ev = std::move(m_events.front());
+
+		m_events.pop_front();
+
+		return ev;
+	}
+
+private:
+	std::pmr::deque<path_monitor_event> m_events;
+};
+
+} // namespace services
+
+#endif // SERVICES_EVENT_QUEUE_HPP
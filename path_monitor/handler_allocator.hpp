@@ -0,0 +1,158 @@
+//
+// handler_allocator.hpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+// Copyright (c) 2003-2018 Christopher M. Kohlhoff (chris at kohlhoff dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_HANDLER_ALLOCATOR_HPP
+#define SERVICES_HANDLER_ALLOCATOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace services {
+
+/// Memory recycled by the operations of one chain of asynchronous calls,
+/// such as a handler calling async_monitor() again. An async_monitor()
+/// operation and the completion it posts are alive one after the other,
+/// so a few blocks serve a chain forever; larger or concurrent requests
+/// fall back to the heap.
+class handler_memory
+{
+public:
+	static constexpr std::size_t block_size = 1024;
+	static constexpr std::size_t block_count = 2;
+
+	handler_memory() = default;
+
+	handler_memory(const handler_memory &) = delete;
+	handler_memory& operator=(const handler_memory &) = delete;
+
+	void* allocate(std::size_t size)
+	{
+		if (size <= block_size) {
+			for (auto &b : m_blocks) {
+				if (!b.in_use.exchange(true, std::memory_order_acquire))
+					return &b.storage;
+			}
+		}
+
+		return ::operator new(size);
+	}
+
+	void deallocate(void *pointer)
+	{
+		for (auto &b : m_blocks) {
+			if (pointer == &b.storage) {
+				b.in_use.store(false, std::memory_order_release);
+
+				return;
+			}
+		}
+
+		::operator delete(pointer);
+	}
+
+private:
+	struct block
+	{
+		typename std::aligned_storage<block_size>::type storage;
+		std::atomic<bool> in_use{ false };
+	};
+
+	block m_blocks[block_count];
+};
+
+/// Allocator drawing from a handler_memory.
+template <typename T>
+class handler_allocator
+{
+public:
+	typedef T value_type;
+
+	explicit handler_allocator(handler_memory &memory)
+		: m_memory(memory)
+	{
+	}
+
+	template <typename U>
+	handler_allocator(const handler_allocator<U> &other) noexcept
+		: m_memory(other.m_memory)
+	{
+	}
+
+	bool operator==(const handler_allocator &other) const noexcept
+	{
+		return &m_memory == &other.m_memory;
+	}
+
+	bool operator!=(const handler_allocator &other) const noexcept
+	{
+		return &m_memory != &other.m_memory;
+	}
+
+	T* allocate(std::size_t n) const
+	{
+		return static_cast<T*>(m_memory.allocate(sizeof(T) * n));
+	}
+
+	void deallocate(T *p, std::size_t) const
+	{
+		return m_memory.deallocate(p);
+	}
+
+private:
+	template <typename> friend class handler_allocator;
+
+	handler_memory &m_memory;
+};
+
+/// Handler wrapper associating a handler_allocator with a handler, so the
+/// operations it is passed to allocate from the given memory.
+template <typename Handler>
+class recycling_handler
+{
+public:
+	typedef handler_allocator<Handler> allocator_type;
+
+	recycling_handler(handler_memory &memory, Handler handler)
+		: m_memory(memory),
+		m_handler(std::move(handler))
+	{
+	}
+
+	allocator_type get_allocator() const noexcept
+	{
+		return allocator_type(m_memory);
+	}
+
+	template <typename ...Args>
+	void operator()(Args&&... args)
+	{
+		m_handler(std::forward<Args>(args)...);
+	}
+
+private:
+	handler_memory &m_memory;
+	Handler m_handler;
+};
+
+/// Wrap a handler to allocate its operations from memory, which must
+/// outlive them.
+template <typename Handler>
+inline recycling_handler<Handler> make_recycling_handler(handler_memory &memory, Handler handler)
+{
+	return recycling_handler<Handler>(memory, std::move(handler));
+}
+
+} // namespace services
+
+#endif // SERVICES_HANDLER_ALLOCATOR_HPP
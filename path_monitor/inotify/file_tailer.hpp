@@ -0,0 +1,258 @@
+//
+// file_tailer.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_FILE_TAILER_HPP
+#define SERVICES_FILE_TAILER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace services {
+
+/// Follows the files of tailed directories, remembering how far each has
+/// been read. Files are opened on their first modification and the most
+/// recently written ones are kept open, so a burst of writes costs one
+/// fstat() and one pread() per event and a rotated file is drained through
+/// its open descriptor after it was renamed away.
+class file_tailer
+{
+public:
+	/// Number of descriptors kept open.
+	static constexpr std::size_t open_files = 64;
+
+	/// Largest range returned by one read().
+	static constexpr std::size_t max_chunk = 1024 * 1024;
+
+	file_tailer() = default;
+
+	file_tailer(const file_tailer &) = delete;
+	file_tailer& operator=(const file_tailer &) = delete;
+
+	~file_tailer()
+	{
+		for (auto *f : m_lru)
+			::close(f->fd);
+	}
+
+	/// Start following a file, or the files of a directory, from their
+	/// current end.
+	void seed(const std::string &path)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		struct stat st;
+
+		if (::stat(path.c_str(), &st) == -1)
+			return;
+
+		if (!S_ISDIR(st.st_mode)) {
+			skip_to_end(path);
+
+			return;
+		}
+
+		DIR *d = ::opendir(path.c_str());
+
+		if (!d)
+			return;
+
+		while (dirent *e = ::readdir(d)) {
+			if (e->d_type == DT_REG or e->d_type == DT_UNKNOWN)
+				skip_to_end(path + "/" + e->d_name);
+		}
+
+		::closedir(d);
+	}
+
+	/// Follow a file that appeared by being renamed into place from its
+	/// current end; its content is not new.
+	void moved_in(const std::string &file)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		forget_locked(file);
+		skip_to_end(file);
+	}
+
+	/// Follow a newly created file from its start.
+	void created(const std::string &file)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		forget_locked(file);
+		m_files[file].offset = 0;
+	}
+
+	/// Stop following a file.
+	void forget(const std::string &file)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		forget_locked(file);
+	}
+
+	/// Stop following the files of a directory.
+	void forget_directory(const std::string &dir)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto prefix = dir + "/";
+
+		for (auto it = m_files.begin(); it != m_files.end();) {
+			if (it->first == dir or it->first.compare(0, prefix.size(), prefix) == 0) {
+				close(it->second);
+				it = m_files.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	/// Read up to max_chunk bytes appended to file since the previous read
+	/// and set offset to their position in the file. A file that shrank was
+	/// truncated and is read again from its start. Returns null when nothing
+	/// was appended. With reopen false only an already open descriptor is
+	/// read, as after a rename the path may name another file.
+	std::shared_ptr<const std::string> read(const std::string &file, std::uint64_t &offset, bool reopen = true)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto it = m_files.find(file);
+
+		if (it == m_files.end()) {
+			if (!reopen)
+				return nullptr;
+
+			it = m_files.emplace(file, followed_file()).first;
+		}
+
+		auto &f = it->second;
+
+		if (f.fd == -1 and (!reopen or !open(f, file)))
+			return nullptr;
+
+		m_lru.splice(m_lru.end(), m_lru, f.lru);
+
+		struct stat st;
+
+		if (::fstat(f.fd, &st) == -1)
+			return nullptr;
+
+		std::uint64_t size = st.st_size;
+
+		if (size < f.offset)
+			f.offset = 0;
+
+		std::size_t n = std::min<std::uint64_t>(size - f.offset, max_chunk);
+
+		if (!n)
+			return nullptr;
+
+		auto data = std::make_shared<std::string>();
+
+		data->resize(n);
+
+		std::size_t got = 0;
+
+		while (got < n) {
+			ssize_t r = ::pread(f.fd, &(*data)[got], n - got, f.offset + got);
+
+			if (r == -1 and errno == EINTR)
+				continue;
+
+			if (r <= 0)
+				break;
+
+			got += r;
+		}
+
+		if (!got)
+			return nullptr;
+
+		data->resize(got);
+		offset = f.offset;
+		f.offset += got;
+
+		return data;
+	}
+
+private:
+	struct followed_file
+	{
+		int fd = -1;
+		std::uint64_t offset = 0;
+		std::list<followed_file*>::iterator lru;	// Valid while open.
+	};
+
+	void skip_to_end(const std::string &file)
+	{
+		struct stat st;
+
+		if (::stat(file.c_str(), &st) == 0 and S_ISREG(st.st_mode))
+			m_files[file].offset = st.st_size;
+	}
+
+	bool open(followed_file &f, const std::string &file)
+	{
+		f.fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (f.fd == -1)
+			return false;
+
+		f.lru = m_lru.insert(m_lru.end(), &f);
+
+		// Close the least recently written file beyond the limit; its
+		// offset is kept.
+		if (m_lru.size() > open_files)
+			close(*m_lru.front());
+
+		return true;
+	}
+
+	void close(followed_file &f)
+	{
+		if (f.fd == -1)
+			return;
+
+		::close(f.fd);
+		m_lru.erase(f.lru);
+		f.fd = -1;
+	}
+
+	void forget_locked(const std::string &file)
+	{
+		auto it = m_files.find(file);
+
+		if (it == m_files.end())
+			return;
+
+		close(it->second);
+		m_files.erase(it);
+	}
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, followed_file> m_files;
+	std::list<followed_file*> m_lru;	// Open files, least recently written first.
+};
+
+} // namespace services
+
+#endif // SERVICES_FILE_TAILER_HPP
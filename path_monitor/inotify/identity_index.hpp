@@ -0,0 +1,212 @@
+//
+// identity_index.hpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_IDENTITY_INDEX_HPP
+#define SERVICES_IDENTITY_INDEX_HPP
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include <sys/stat.h>
+
+#include "../basic_path_monitor.hpp"
+#include "../tree_snapshot.hpp"
+
+namespace services {
+
+/// Assigns files of watched directories an identifier that follows them
+/// across renames and moves between those directories. Files are keyed by
+/// device and inode; a rename is followed through the cookie pairing its
+/// two events, so the file need not exist anymore when they are handled.
+class identity_index
+{
+public:
+	/// Renames whose second half is awaited; a file moved out of the watched
+	/// directories never completes one.
+	static constexpr std::size_t max_pending_moves = 1024;
+
+	identity_index() = default;
+
+	identity_index(const identity_index &) = delete;
+	identity_index& operator=(const identity_index &) = delete;
+
+	/// Assign identifiers to the entries of a directory.
+	void seed(const std::string &dir)
+	{
+		std::error_code ec;
+		auto entries = scan_directory(dir, ec);
+
+		struct stat st;
+
+		if (ec or ::stat(dir.c_str(), &st) == -1)
+			return;
+
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		for (const auto &e : entries)
+			link(dir + "/" + e.name, key_type(st.st_dev, e.inode));
+	}
+
+	/// Forget the entries of a directory.
+	void forget_directory(const std::string &dir)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto prefix = dir + "/";
+
+		for (auto it = m_paths.begin(); it != m_paths.end();) {
+			if (it->first.compare(0, prefix.size(), prefix) == 0) {
+				release(it->second);
+				it = m_paths.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	/// Return the identifier of the file an event is about, updating the
+	/// index, or zero if the file is unknown and cannot be examined.
+	std::uint64_t update(const path_monitor_event &ev)
+	{
+		auto file = (ev.parent_path / ev.path).string();
+
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		switch (ev.event) {
+			case path_monitor_event::type::removed:
+				return unlink(file);
+
+			case path_monitor_event::type::renamed_old_name:
+			{
+				auto it = m_paths.find(file);
+
+				if (it == m_paths.end())
+					return 0;
+
+				// The pending move keeps the identity alive until the
+				// file reappears under its new name.
+				auto key = it->second;
+
+				m_paths.erase(it);
+				m_moves.emplace_back(ev.cookie, key);
+
+				if (m_moves.size() > max_pending_moves) {
+					release(m_moves.front().second);
+					m_moves.pop_front();
+				}
+
+				return m_identities[key].id;
+			}
+
+			case path_monitor_event::type::renamed_new_name:
+				for (auto it = m_moves.rbegin(); it != m_moves.rend(); ++it) {
+					if (it->first != ev.cookie)
+						continue;
+
+					auto key = it->second;
+
+					m_moves.erase(std::next(it).base());
+					unlink(file);
+					m_paths[file] = key;
+
+					return m_identities[key].id;
+				}
+
+				break;
+
+			default:
+			{
+				auto it = m_paths.find(file);
+
+				if (it != m_paths.end() and ev.event != path_monitor_event::type::added)
+					return m_identities[it->second].id;
+
+				break;
+			}
+		}
+
+		// A new name; the inode tells whether the file is already known,
+		// such as a hard link or a file moved in from a directory whose
+		// rename event was missed.
+		lk.unlock();
+
+		std::error_code ec;
+		auto m = ev.metadata(ec);
+
+		if (ec)
+			return 0;
+
+		lk.lock();
+		unlink(file);
+
+		return link(file, key_type(m.device, m.inode));
+	}
+
+private:
+	typedef std::pair<std::uint64_t, std::uint64_t> key_type;	// Device, inode.
+
+	struct identity
+	{
+		std::uint64_t id = 0;
+		std::size_t references = 0;	// Names and pending moves.
+	};
+
+	std::uint64_t link(const std::string &file, key_type key)
+	{
+		auto &i = m_identities[key];
+
+		if (!i.id)
+			i.id = m_next_id++;
+
+		if (m_paths.emplace(file, key).second)
+			++i.references;
+
+		return i.id;
+	}
+
+	std::uint64_t unlink(const std::string &file)
+	{
+		auto it = m_paths.find(file);
+
+		if (it == m_paths.end())
+			return 0;
+
+		auto id = m_identities[it->second].id;
+
+		release(it->second);
+		m_paths.erase(it);
+
+		return id;
+	}
+
+	void release(key_type key)
+	{
+		auto it = m_identities.find(key);
+
+		if (it != m_identities.end() and !--it->second.references)
+			m_identities.erase(it);
+	}
+
+	std::mutex m_mutex;
+	std::uint64_t m_next_id = 1;
+	std::map<key_type, identity> m_identities;
+	std::unordered_map<std::string, key_type> m_paths;
+	std::deque<std::pair<std::uint32_t, key_type>> m_moves;	// Cookie, file.
+};
+
+} // namespace services
+
+#endif // SERVICES_IDENTITY_INDEX_HPP
@@ -0,0 +1,148 @@
+//
+// inotify_parser.hpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_INOTIFY_PARSER_HPP
+#define SERVICES_INOTIFY_PARSER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+#include <limits.h>
+#include <sys/inotify.h>
+
+namespace services {
+
+/// A decoded inotify record. name refers to the parsed buffer and is valid
+/// only during the callback.
+struct inotify_record_view
+{
+	int wd;
+	std::uint32_t mask;
+	std::uint32_t cookie;
+	std::string_view name;	// Without the NUL padding, empty for watched files.
+};
+
+/// Decodes the byte stream read from an inotify descriptor. Reads may end
+/// inside a record; the partial record is kept and completed by the next
+/// buffer, and only it is ever copied. Records are decoded in place
+/// without alignment requirements on the buffer.
+class inotify_parser
+{
+public:
+	/// Largest record the kernel produces: the header and a NUL terminated
+	/// name padded to the header alignment.
+	static constexpr std::size_t max_record_size = sizeof(inotify_event) + NAME_MAX + 1 + sizeof(inotify_event);
+
+	explicit inotify_parser(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+		: m_pending(resource)
+	{
+	}
+
+	/// Call f(const inotify_record_view &) for every record completed by
+	/// data. Returns false, dropping buffered bytes, if a record claims a
+	/// name longer than the kernel allows; the stream cannot be trusted
+	/// past it.
+	template <typename Function>
+	bool parse(const char *data, std::size_t size, Function &&f)
+	{
+		// Complete a record left over by the previous buffer first, its
+		// header and then its name.
+		while (!m_pending.empty()) {
+			std::size_t need = sizeof(inotify_event);
+
+			if (m_pending.size() >= need and !record_size(m_pending.data(), need))
+				return reset();
+
+			if (m_pending.size() == need) {
+				decode(m_pending.data(), f);
+				m_pending.clear();
+
+				break;
+			}
+
+			if (!size)
+				return true;
+
+			std::size_t take = std::min(need - m_pending.size(), size);
+
+			m_pending.append(data, take);
+			data += take;
+			size -= take;
+		}
+
+		std::size_t offset = 0;
+		std::size_t record;
+
+		while (size - offset >= sizeof(inotify_event)) {
+			if (!record_size(data + offset, record))
+				return reset();
+
+			if (size - offset < record)
+				break;
+
+			decode(data + offset, f);
+			offset += record;
+		}
+
+		// Keep a trailing partial record for the next buffer.
+		m_pending.assign(data + offset, size - offset);
+
+		return true;
+	}
+
+	/// Number of bytes of an incomplete record held back.
+	std::size_t pending() const
+	{
+		return m_pending.size();
+	}
+
+private:
+	static bool record_size(const char *p, std::size_t &size)
+	{
+		std::uint32_t len;
+
+		std::memcpy(&len, p + offsetof(inotify_event, len), sizeof(len));
+
+		size = sizeof(inotify_event) + len;
+
+		return size <= max_record_size;
+	}
+
+	template <typename Function>
+	static void decode(const char *p, Function &f)
+	{
+		inotify_event iev;
+
+		std::memcpy(&iev, p, sizeof(iev));
+
+		const char *name = p + sizeof(inotify_event);
+
+		f(inotify_record_view{ iev.wd, iev.mask, iev.cookie,
+				       std::string_view(name, iev.len ? ::strnlen(name, iev.len) : 0) });
+	}
+
+	bool reset()
+	{
+		m_pending.clear();
+
+		return false;
+	}
+
+	std::pmr::string m_pending;
+};
+
+} // namespace services
+
+#endif // SERVICES_INOTIFY_PARSER_HPP
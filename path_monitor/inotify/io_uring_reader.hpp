@@ -0,0 +1,433 @@
+//
+// io_uring_reader.hpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_IO_URING_READER_HPP
+#define SERVICES_IO_URING_READER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace services {
+
+/// Reads the inotify descriptors of many monitors through one io_uring
+/// instead of an epoll reactor per monitor. Every monitor has a read with a
+/// registered buffer posted at all times; completions are drained in bulk by
+/// a single thread and the follow-up reads of all monitors that had data are
+/// submitted with one io_uring_enter().
+///
+/// Implementation must provide native_handle() returning the inotify
+/// descriptor, bool consume_read(const char *, std::size_t) to parse records,
+/// false once they are corrupt and no longer read, and begin_read() to start
+/// its own epoll read. A monitor whose read fails, or every monitor if the
+/// ring itself fails, falls back to begin_read().
+template <typename Implementation>
+class io_uring_reader
+{
+public:
+	/// Number of monitors that can be attached; further monitors keep using
+	/// the epoll reactor.
+	static constexpr std::size_t slot_count = 64;
+
+	/// Size of the registered read buffer of each monitor.
+	static constexpr std::size_t buffer_size = 16 * 1024;
+
+	io_uring_reader()
+		: m_buffers(slot_count * buffer_size)
+	{
+		io_uring_params params;
+
+		std::memset(&params, 0, sizeof(params));
+
+		m_fd = ::syscall(__NR_io_uring_setup, slot_count * 2, &params);
+
+		if (m_fd == -1) {
+			throw std::system_error(std::error_code(errno, std::system_category()),
+						"service::io_uring_reader: io_uring_setup failed");
+		}
+
+		try {
+			map_rings(params);
+			register_buffers();
+		} catch (...) {
+			unmap_rings();
+			::close(m_fd);
+
+			throw;
+		}
+
+		m_thread = std::thread(&io_uring_reader::run, this);
+	}
+
+	io_uring_reader(const io_uring_reader &) = delete;
+	io_uring_reader& operator=(const io_uring_reader &) = delete;
+
+	~io_uring_reader()
+	{
+		{
+			std::unique_lock<std::mutex> lk(m_mutex);
+
+			m_run = false;
+
+			io_uring_sqe *sqe = next_sqe();
+
+			if (sqe) {
+				sqe->opcode = IORING_OP_NOP;
+				sqe->user_data = wakeup;
+				submit(1);
+			}
+		}
+
+		m_thread.join();
+
+		unmap_rings();
+		::close(m_fd);
+	}
+
+	/// Start reading a monitor's descriptor. Returns false if no slot is
+	/// free or the monitor has no descriptor.
+	bool add(std::shared_ptr<Implementation> impl)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		if (m_failed or m_entries.size() == slot_count or impl->native_handle() == -1)
+			return false;
+
+		std::size_t slot = 0;
+
+		while (m_used[slot])
+			++slot;
+
+		// io_uring completes reads on blocking descriptors when data
+		// arrives; on non-blocking ones it would fail with EAGAIN.
+		int fd = impl->native_handle();
+
+		::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+		m_used[slot] = true;
+		m_entries[slot] = entry{ impl, false };
+
+		post_read(slot);
+		submit(m_pending);
+
+		return true;
+	}
+
+	/// Stop reading a monitor's descriptor. The implementation is released
+	/// once its outstanding read has completed.
+	void remove(const std::shared_ptr<Implementation> &impl)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		for (auto &e : m_entries) {
+			if (e.second.impl != impl or e.second.removing)
+				continue;
+
+			e.second.removing = true;
+
+			io_uring_sqe *sqe = next_sqe();
+
+			if (sqe) {
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->addr = e.first;
+				sqe->user_data = cancel;
+				submit(1);
+			}
+
+			return;
+		}
+	}
+
+private:
+	static constexpr std::uint64_t wakeup = ~std::uint64_t(0);
+	static constexpr std::uint64_t cancel = ~std::uint64_t(0) - 1;
+
+	struct entry
+	{
+		std::shared_ptr<Implementation> impl;
+		bool removing;
+	};
+
+	void map_rings(const io_uring_params &params)
+	{
+		m_sq_size = params.sq_off.array + params.sq_entries * sizeof(std::uint32_t);
+		m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+			m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+
+		m_sq_ring = map(m_sq_size, IORING_OFF_SQ_RING);
+		m_cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? m_sq_ring : map(m_cq_size, IORING_OFF_CQ_RING);
+		m_sqes = static_cast<io_uring_sqe*>(map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+		m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+		char *sq = static_cast<char*>(m_sq_ring);
+		char *cq = static_cast<char*>(m_cq_ring);
+
+		m_sq_head = reinterpret_cast<std::uint32_t*>(sq + params.sq_off.head);
+		m_sq_tail = reinterpret_cast<std::uint32_t*>(sq + params.sq_off.tail);
+		m_sq_mask = *reinterpret_cast<std::uint32_t*>(sq + params.sq_off.ring_mask);
+		m_sq_entries = params.sq_entries;
+		m_sq_array = reinterpret_cast<std::uint32_t*>(sq + params.sq_off.array);
+		m_cq_head = reinterpret_cast<std::uint32_t*>(cq + params.cq_off.head);
+		m_cq_tail = reinterpret_cast<std::uint32_t*>(cq + params.cq_off.tail);
+		m_cq_mask = *reinterpret_cast<std::uint32_t*>(cq + params.cq_off.ring_mask);
+		m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+	}
+
+	void *map(std::size_t size, off_t offset)
+	{
+		void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+
+		if (p == MAP_FAILED) {
+			throw std::system_error(std::error_code(errno, std::system_category()),
+						"service::io_uring_reader: mapping rings failed");
+		}
+
+		return p;
+	}
+
+	void unmap_rings()
+	{
+		if (m_sqes)
+			::munmap(m_sqes, m_sqes_size);
+
+		if (m_cq_ring and m_cq_ring != m_sq_ring)
+			::munmap(m_cq_ring, m_cq_size);
+
+		if (m_sq_ring)
+			::munmap(m_sq_ring, m_sq_size);
+
+		m_sqes = nullptr;
+		m_sq_ring = m_cq_ring = nullptr;
+	}
+
+	void register_buffers()
+	{
+		std::vector<iovec> iovecs(slot_count);
+
+		for (std::size_t i = 0; i < slot_count; ++i)
+			iovecs[i] = iovec{ m_buffers.data() + i * buffer_size, buffer_size };
+
+		if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, iovecs.data(), iovecs.size()) == -1) {
+			throw std::system_error(std::error_code(errno, std::system_category()),
+						"service::io_uring_reader: registering buffers failed");
+		}
+	}
+
+	/// Return a free submission queue entry; m_mutex must be held.
+	io_uring_sqe *next_sqe()
+	{
+		std::uint32_t head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+		std::uint32_t tail = *m_sq_tail + m_pending;
+
+		if (tail - head >= m_sq_entries)
+			return nullptr;
+
+		std::uint32_t index = tail & m_sq_mask;
+		io_uring_sqe *sqe = &m_sqes[index];
+
+		std::memset(sqe, 0, sizeof(*sqe));
+		m_sq_array[index] = index;
+		++m_pending;
+
+		return sqe;
+	}
+
+	/// Queue the read of a slot; m_mutex must be held.
+	void post_read(std::size_t slot)
+	{
+		io_uring_sqe *sqe = next_sqe();
+
+		if (!sqe)
+			return;
+
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->fd = m_entries[slot].impl->native_handle();
+		sqe->addr = reinterpret_cast<std::uint64_t>(m_buffers.data() + slot * buffer_size);
+		sqe->len = buffer_size;
+		sqe->buf_index = slot;
+		sqe->user_data = slot;
+	}
+
+	/// Publish queued entries and hand them to the kernel; m_mutex must be
+	/// held.
+	void submit(std::uint32_t count)
+	{
+		__atomic_store_n(m_sq_tail, *m_sq_tail + m_pending, __ATOMIC_RELEASE);
+		m_pending = 0;
+
+		while (count and ::syscall(__NR_io_uring_enter, m_fd, count, 0, 0, nullptr, 0) == -1 and errno == EINTR)
+			;
+	}
+
+	void run()
+	{
+		std::vector<std::pair<std::size_t, int>> completions;
+
+		for (;;) {
+			int r = ::syscall(__NR_io_uring_enter, m_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+			if (r == -1 and errno != EINTR) {
+				fail();
+
+				return;
+			}
+
+			completions.clear();
+
+			std::uint32_t head = *m_cq_head;
+			std::uint32_t tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+			for (; head != tail; ++head) {
+				const io_uring_cqe &cqe = m_cqes[head & m_cq_mask];
+
+				if (cqe.user_data < slot_count)
+					completions.emplace_back(cqe.user_data, cqe.res);
+			}
+
+			__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+			// Parse outside the lock; the slot buffers are not reposted yet.
+			std::vector<std::shared_ptr<Implementation>> impls;
+
+			{
+				std::unique_lock<std::mutex> lk(m_mutex);
+
+				if (!m_run)
+					return;
+
+				for (const auto &c : completions)
+					impls.push_back(m_entries[c.first].impl);
+			}
+
+			// A monitor whose records are corrupt stops reading.
+			std::vector<bool> corrupt(completions.size());
+
+			for (std::size_t i = 0; i < completions.size(); ++i) {
+				if (completions[i].second > 0)
+					corrupt[i] = !impls[i]->consume_read(m_buffers.data() + completions[i].first * buffer_size,
+									     completions[i].second);
+			}
+
+			std::vector<std::shared_ptr<Implementation>> failed;
+			std::unique_lock<std::mutex> lk(m_mutex);
+
+			for (std::size_t i = 0; i < completions.size(); ++i) {
+				const auto &c = completions[i];
+				auto &e = m_entries[c.first];
+
+				if (e.removing or corrupt[i] or (c.second < 0 and c.second != -EINTR and c.second != -EAGAIN)) {
+					if (!e.removing and !corrupt[i])
+						failed.push_back(e.impl);
+
+					m_entries.erase(c.first);
+					m_used[c.first] = false;
+
+					continue;
+				}
+
+				post_read(c.first);
+			}
+
+			// One submission re-arms every monitor that completed.
+			submit(m_pending);
+			lk.unlock();
+
+			for (const auto &impl : failed)
+				fall_back(impl);
+		}
+	}
+
+	/// Hand every monitor back to its own epoll read once the ring failed,
+	/// so that none silently stops receiving events.
+	void fail()
+	{
+		std::vector<std::shared_ptr<Implementation>> impls;
+
+		{
+			std::unique_lock<std::mutex> lk(m_mutex);
+
+			m_failed = true;
+
+			// Outstanding reads would otherwise take data from the
+			// epoll reads; cancelling them is best effort.
+			for (const auto &e : m_entries) {
+				if (io_uring_sqe *sqe = next_sqe()) {
+					sqe->opcode = IORING_OP_ASYNC_CANCEL;
+					sqe->addr = e.first;
+					sqe->user_data = cancel;
+				}
+
+				if (!e.second.removing)
+					impls.push_back(e.second.impl);
+			}
+
+			submit(m_pending);
+			m_entries.clear();
+			std::fill(std::begin(m_used), std::end(m_used), false);
+		}
+
+		for (const auto &impl : impls)
+			fall_back(impl);
+	}
+
+	static void fall_back(const std::shared_ptr<Implementation> &impl)
+	{
+		int fd = impl->native_handle();
+
+		::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+		impl->begin_read();
+	}
+
+	int m_fd = -1;
+	std::vector<char> m_buffers;
+	void *m_sq_ring = nullptr;
+	void *m_cq_ring = nullptr;
+	std::size_t m_sq_size = 0;
+	std::size_t m_cq_size = 0;
+	io_uring_sqe *m_sqes = nullptr;
+	std::size_t m_sqes_size = 0;
+	std::uint32_t *m_sq_head = nullptr;
+	std::uint32_t *m_sq_tail = nullptr;
+	std::uint32_t m_sq_mask = 0;
+	std::uint32_t m_sq_entries = 0;
+	std::uint32_t *m_sq_array = nullptr;
+	std::uint32_t *m_cq_head = nullptr;
+	std::uint32_t *m_cq_tail = nullptr;
+	std::uint32_t m_cq_mask = 0;
+	io_uring_cqe *m_cqes = nullptr;
+	std::uint32_t m_pending = 0;
+	std::mutex m_mutex;
+	bool m_run = true;
+	bool m_failed = false;
+	bool m_used[slot_count] = {};
+	std::map<std::uint64_t, entry> m_entries;
+	std::thread m_thread;
+};
+
+} // namespace services
+
+#endif // SERVICES_IO_URING_READER_HPP
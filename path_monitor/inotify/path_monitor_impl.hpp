@@ -12,35 +12,69 @@
 #ifndef SERVICES_PATH_MONITOR_IMPL_HPP
 #define SERVICES_PATH_MONITOR_IMPL_HPP
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <filesystem>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <optional>
 #include <thread>
 #include <system_error>
+#include <vector>
 
 #define BOOST_ERROR_CODE_HEADER_ONLY
 #include <boost/asio/executor_work_guard.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/placeholders.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/posix/stream_descriptor.hpp>
-#include <boost/bimap.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <sys/inotify.h>
 #include <errno.h>
 
+#include "../directory_index.hpp"
+#include "../event_batch.hpp"
+#include "../event_queue.hpp"
+#include "../path_monitor_policy.hpp"
+#include "../tree_snapshot.hpp"
+#include "file_tailer.hpp"
+#include "identity_index.hpp"
+#include "inotify_parser.hpp"
+#include "ready_tracker.hpp"
+#include "watch_manager.hpp"
+
 namespace services {
 
-class path_monitor_impl
-	: public std::enable_shared_from_this<path_monitor_impl>
+/// inotify backend, configured at compile time by a path_monitor_policy.
+template <typename Policy = default_path_monitor_policy>
+class basic_path_monitor_impl
+	: public std::enable_shared_from_this<basic_path_monitor_impl<Policy>>
 {
 public:
-	path_monitor_impl(const std::string &identifier)
+	typedef typename Policy::threading::mutex_type mutex_type;
+	typedef typename Policy::queue_type queue_type;
+
+	/// Queued events and the pending read buffer are allocated from
+	/// resource, which must outlive the implementation.
+	basic_path_monitor_impl(const std::string &identifier,
+				std::pmr::memory_resource *resource = std::pmr::get_default_resource())
 		: m_identifier(identifier),
 		m_fd(init_fd()),
 		m_stream_descriptor(m_inotify_io_context, m_fd),
+		m_snapshot_timer(m_inotify_io_context),
 		m_inotify_work(boost::asio::make_work_guard(m_inotify_io_context)),
-		m_inotify_work_thread(std::bind(static_cast<std::size_t (boost::asio::io_context::*)()>(
-			&boost::asio::io_context::run), &m_inotify_io_context))
+		m_inotify_work_thread(start_reader()),
+		m_parser(resource),
+		m_watches(m_fd),
+		m_poll_timer(m_inotify_io_context),
+		m_settle_timer(m_inotify_io_context),
+		m_events(resource)
 	{
 	}
 
@@ -51,54 +85,216 @@ public:
 	}
 
 	/// Add path to monitor.
-	void add_path(const std::filesystem::path &path, std::system_error &se)
+	void add_path(const std::filesystem::path &path, const watch_options &options, std::system_error &se)
 	{
-		int wd = inotify_add_watch(m_fd, path.c_str(), IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVE);
-
-		if (wd == -1) {
-			se = std::system_error(std::error_code(errno, std::system_category()),
-					       "service::path_monitor_impl::add_path: inotify_add_watch for \"" +
-					       path.string() + "\" path failed");
+		m_watches.add(path.string(), options, se);
 
+		if (se.code())
 			return;
-		}
 
-		std::unique_lock<std::mutex> lk(m_watch_descriptors_mutex);
+		if (options.tail)
+			m_tailer.seed(path.string());
+
+		if (options.identity)
+			m_identities.seed(path.string());
 
-		m_watch_descriptors.insert(watch_descriptors_type::value_type(wd, path.string()));
+		if (options.index)
+			seed_index(path.string());
 
-		se = std::system_error(std::error_code());
+		begin_polling();
 	}
 
 	/// Remove path from monitor.
 	void remove_path(const std::filesystem::path &path, std::system_error &se)
 	{
-		std::unique_lock<std::mutex> lk(m_watch_descriptors_mutex);
+		m_watches.remove(path.string(), se);
 
-		auto it = m_watch_descriptors.right.find(path.string());
+		if (!se.code()) {
+			m_tailer.forget_directory(path.string());
+			m_identities.forget_directory(path.string());
+			m_ready.forget_directory(path.string());
+			m_index.forget(path.string());
+		}
+	}
 
-		if (it != m_watch_descriptors.right.end()) {
-			int i = inotify_rm_watch(m_fd, it->second);
+	/// Limit the number of inotify watches, polling the least recently active
+	/// directories beyond it.
+	void set_watch_budget(std::size_t max_watches, std::chrono::steady_clock::duration poll_interval, std::system_error &se)
+	{
+		{
+			std::unique_lock<mutex_type> lk(m_events_mutex);
 
-			if (i == -1) {
-				se = std::system_error(std::error_code(errno, std::system_category()),
-						       "service::path_monitor_impl::remove_path: inotify_rm_watch for \"" +
-						       path.string() + "\" path failed");
+			m_poll_interval = poll_interval;
+		}
 
+		m_watches.set_budget(max_watches);
+		begin_polling();
+
+		se = operation_succeeded();
+	}
+
+	/// Return counters describing the monitor.
+	path_monitor_stats stats()
+	{
+		path_monitor_stats s;
+
+		m_watches.stats(s);
+
+		std::unique_lock<mutex_type> lk(m_events_mutex);
+
+		s.queued_events = m_events.size();
+		s.queued_by_priority = m_events.depths();
+
+		return s;
+	}
+
+	/// Record the state of all watched directories in a snapshot file.
+	void save_snapshot(const std::filesystem::path &file, std::system_error &se)
+	{
+		auto directories = watched_directories();
+		std::vector<std::pair<std::string, std::vector<directory_entry_state>>> states(directories.size());
+
+		parallel_for_each_index(directories.size(), [&](std::size_t i) {
+			std::error_code ec;
+
+			states[i] = std::make_pair(directories[i], scan_directory(directories[i], ec));
+		});
+
+		tree_snapshot::write(file, std::move(states), se);
+	}
+
+	/// Queue the changes made to the watched directories since a snapshot was
+	/// saved ahead of any live events. Directories missing from the snapshot
+	/// have no baseline and are skipped.
+	void restore_snapshot(const std::filesystem::path &file, std::system_error &se)
+	{
+		tree_snapshot snapshot;
+
+		snapshot.open(file, se);
+
+		if (se.code())
+			return;
+
+		auto directories = watched_directories();
+		std::vector<std::vector<path_monitor_event>> events(directories.size());
+
+		parallel_for_each_index(directories.size(), [&](std::size_t i) {
+			std::vector<tree_snapshot::entry_view> recorded;
+
+			if (!snapshot.find(directories[i], recorded))
 				return;
-			}
 
-			m_watch_descriptors.right.erase(it);
+			std::error_code ec;
+			auto live = scan_directory(directories[i], ec);
+
+			if (!ec or ec == std::errc::no_such_file_or_directory)
+				tree_snapshot::diff(directories[i], recorded, live, events[i]);
+		});
+
+		std::vector<path_monitor_event> missed;
+
+		for (auto &e : events)
+			std::move(e.begin(), e.end(), std::back_inserter(missed));
+
+		pushfront_events(std::move(missed));
+
+		se = operation_succeeded();
+	}
+
+	/// Save a snapshot to file when the monitor is destroyed and, if interval
+	/// is non-zero, periodically while it runs.
+	void set_snapshot(const std::filesystem::path &file, std::chrono::steady_clock::duration interval, std::system_error &se)
+	{
+		{
+			std::unique_lock<mutex_type> lk(m_events_mutex);
+
+			m_snapshot_file = file;
 		}
 
-		se = std::system_error(std::error_code());
+		boost::asio::post(m_inotify_io_context, [weak = this->weak_from_this(), interval]() {
+			if (auto self = weak.lock()) {
+				self->m_snapshot_interval = interval;
+				self->m_snapshot_timer.cancel();
+
+				if (interval != std::chrono::steady_clock::duration::zero())
+					self->begin_snapshot_wait();
+			}
+		});
+
+		se = operation_succeeded();
+	}
+
+	/// Deliver events in columnar batches decoded from each read instead of
+	/// queueing them; null restores queueing. Batches skip the per-event
+	/// features: tailing, identities, ready events, watching new
+	/// subdirectories and directory indexes. Event sinks are still fed,
+	/// from events decoded out of each batch. Events found by polling
+	/// demoted directories are still queued.
+	void set_batch_sink(std::shared_ptr<event_batch_sink> sink, std::system_error &se)
+	{
+		std::unique_lock<mutex_type> lk(m_sinks_mutex);
+
+		m_batch_sink = sink;
+
+		se = operation_succeeded();
+	}
+
+	/// Return the indexed entries of a directory.
+	std::shared_ptr<const directory_listing> list_directory(const std::filesystem::path &dir, std::system_error &se)
+	{
+		auto key = dir.lexically_normal().string();
+
+		while (key.size() > 1 and key.back() == '/')
+			key.pop_back();
+
+		auto listing = m_index.list(key);
+
+		if (listing)
+			se = operation_succeeded();
+		else
+			se = std::system_error(std::make_error_code(std::errc::no_such_file_or_directory),
+					       "service::path_monitor_impl::list_directory: directory not indexed");
+
+		return listing;
+	}
+
+	/// Attach a stage that observes every queued event.
+	void add_sink(std::shared_ptr<path_monitor_event_sink> sink)
+	{
+		std::unique_lock<mutex_type> lk(m_sinks_mutex);
+
+		m_sinks.push_back(sink);
+	}
+
+	/// Detach an event sink.
+	void remove_sink(std::shared_ptr<path_monitor_event_sink> sink)
+	{
+		std::unique_lock<mutex_type> lk(m_sinks_mutex);
+
+		m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink), m_sinks.end());
 	}
 
 	/// Destroy a path monitor implementation.
 	void destroy()
 	{
+		std::filesystem::path snapshot_file;
+
+		{
+			std::unique_lock<mutex_type> lk(m_events_mutex);
+
+			snapshot_file = m_snapshot_file;
+		}
+
+		if (!snapshot_file.empty()) {
+			std::system_error se;
+
+			save_snapshot(snapshot_file, se);
+		}
+
+		std::function<void()> ready;
+
 		{
-			std::unique_lock<std::mutex> lk(m_events_mutex);
+			std::unique_lock<mutex_type> lk(m_events_mutex);
 
 			if (!m_run)
 				return;
@@ -107,29 +303,42 @@ public:
 			m_inotify_io_context.stop();
 
 			m_run = false;
+			ready.swap(m_ready_handler);
 		}
 
 		m_events_cond.notify_all();
 
-		m_inotify_work_thread.join();
+		if (m_inotify_work_thread.joinable())
+			m_inotify_work_thread.join();
+
+		// Let a subscription learn of the shutdown.
+		if (ready)
+			ready();
 	}
 
-	/// Get earliest inotify event (FIFO).
+	/// Get earliest inotify event (FIFO). A single threaded monitor reads
+	/// the kernel's queue while it waits. Once the queued events are taken,
+	/// fail with std::errc::bad_message if the kernel's records could not
+	/// be decoded; nothing is read after that.
 	path_monitor_event popfront_event(std::system_error &se)
 	{
-		std::unique_lock<std::mutex> lk(m_events_mutex);
+		std::unique_lock<mutex_type> lk(m_events_mutex);
 
-		while (m_run && m_events.empty())
-			m_events_cond.wait(lk);
+		while (m_run && m_events.empty() && !m_read_error) {
+			if constexpr (Policy::threading::threaded)
+				m_events_cond.wait(lk);
+			else
+				m_inotify_io_context.run_one();
+		}
 
 		path_monitor_event ev;
 
 		if (!m_events.empty()) {
-			ev = m_events.front();
+			ev = m_events.pop_front();
 
-			m_events.pop_front();
-
-			se = std::system_error(std::error_code());
+			se = operation_succeeded();
+		} else if (m_run) {
+			se = std::system_error(m_read_error, "service::path_monitor_impl::popfront_event: inotify records corrupt");
 		} else {
 			se = std::system_error(std::error_code(static_cast<int>(std::errc::operation_canceled), std::system_category()),
 					       "service::path_monitor_impl::popfront_event: operation canceled");
@@ -138,18 +347,114 @@ public:
 		return ev;
 	}
 
-	/// Insert inotify event into FIFO.
-	void pushback_event(path_monitor_event ev)
+	/// Move up to max queued events to the end of evs without waiting.
+	/// Once the monitor is destroyed and drained, fail with
+	/// std::errc::operation_canceled, or with std::errc::bad_message once
+	/// drained after its records could not be decoded.
+	void popfront_events(std::vector<path_monitor_event> &evs, std::size_t max, std::system_error &se)
 	{
-		std::unique_lock<std::mutex> lk(m_events_mutex);
+		if constexpr (!Policy::threading::threaded)
+			m_inotify_io_context.poll();
+
+		std::unique_lock<mutex_type> lk(m_events_mutex);
+
+		for (std::size_t i = 0; i < max and !m_events.empty(); ++i)
+			evs.push_back(m_events.pop_front());
+
+		if (evs.empty() and !m_run) {
+			se = std::system_error(std::error_code(static_cast<int>(std::errc::operation_canceled), std::system_category()),
+					       "service::path_monitor_impl::popfront_events: operation canceled");
+		} else if (evs.empty() and m_read_error) {
+			se = std::system_error(m_read_error, "service::path_monitor_impl::popfront_events: inotify records corrupt");
+		} else {
+			se = operation_succeeded();
+		}
+	}
+
+	/// Have ready called once, from the thread queueing it, when the next
+	/// event is queued or the monitor is destroyed. Returns false without
+	/// storing ready if events are queued already or the monitor was
+	/// destroyed.
+	bool notify_when_ready(std::function<void()> ready)
+	{
+		std::unique_lock<mutex_type> lk(m_events_mutex);
+
+		if (!m_events.empty() or !m_run or m_read_error)
+			return false;
+
+		m_ready_handler = std::move(ready);
+
+		return true;
+	}
 
-		if (m_run) {
-			m_events.push_back(ev);
+	/// Insert inotify event into the FIFO of its priority.
+	void pushback_event(path_monitor_event ev, watch_priority priority = watch_priority::normal)
+	{
+		notify_sinks(ev);
+
+		std::function<void()> ready;
+
+		{
+			std::unique_lock<mutex_type> lk(m_events_mutex);
+
+			if (!m_run)
+				return;
+
+			m_events.push_back(std::move(ev), priority);
 			m_events_cond.notify_all();
+
+			ready.swap(m_ready_handler);
 		}
+
+		if (ready)
+			ready();
+	}
+
+	/// Insert events ahead of those already queued with the same priority,
+	/// preserving their order.
+	void pushfront_events(std::vector<path_monitor_event> evs)
+	{
+		std::array<std::vector<path_monitor_event>, queue_type::lane_count> lanes;
+
+		for (auto &ev : evs) {
+			notify_sinks(ev);
+
+			auto priority = m_watches.options(ev.parent_path.string())->priority;
+
+			lanes[static_cast<std::size_t>(priority)].push_back(std::move(ev));
+		}
+
+		std::function<void()> ready;
+
+		{
+			std::unique_lock<mutex_type> lk(m_events_mutex);
+
+			if (!m_run or evs.empty())
+				return;
+
+			for (std::size_t i = 0; i < lanes.size(); ++i)
+				m_events.push_front(std::move(lanes[i]), static_cast<watch_priority>(i));
+
+			m_events_cond.notify_all();
+
+			ready.swap(m_ready_handler);
+		}
+
+		if (ready)
+			ready();
 	}
 
 private:
+	/// Start the thread reading the kernel's queue, none if single threaded.
+	std::thread start_reader()
+	{
+		if constexpr (Policy::threading::threaded)
+			return std::thread(std::bind(static_cast<std::size_t (boost::asio::io_context::*)()>(
+				&boost::asio::io_context::run), &m_inotify_io_context));
+		else
+			return std::thread();
+	}
+
 	int init_fd()
 	{
 		int fd = inotify_init1(IN_NONBLOCK);
@@ -163,89 +468,507 @@ private:
 	}
 
 public:
+	/// Return the inotify descriptor.
+	int native_handle() const
+	{
+		return m_fd;
+	}
+
+	/// Parse bytes read from the inotify descriptor and queue the events.
+	/// Called by the reader of the descriptor only. Returns false if the
+	/// records are corrupt, after which the descriptor is not read again.
+	bool consume_read(const char *data, std::size_t bytes_transferred)
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		std::shared_ptr<event_batch_sink> batch_sink;
+
+		{
+			std::unique_lock<mutex_type> lk(m_sinks_mutex);
+
+			batch_sink = m_batch_sink;
+		}
+
+		if (batch_sink)
+			return consume_batch(data, bytes_transferred, now, *batch_sink);
+
+		bool parsed = m_parser.parse(data, bytes_transferred, [this, now](const inotify_record_view &r) {
+			// The kernel dropped the watch, the directory is gone.
+			if (r.mask & IN_IGNORED) {
+				m_index.forget(m_watches.release(r.wd));
+
+				return;
+			}
+
+			// Events were lost; indexed listings can no longer be patched.
+			if (r.mask & IN_Q_OVERFLOW)
+				m_index.invalidate();
+
+			if (r.mask & (IN_UNMOUNT | IN_Q_OVERFLOW | IN_DELETE_SELF))
+				return;
+
+			auto type = event_type(r.mask);
+
+			std::shared_ptr<const watch_options> options;
+			path_monitor_event ev(m_watches.touch(r.wd, options), r.name, type);
+
+			ev.is_directory = r.mask & IN_ISDIR;
+			ev.cookie = r.cookie;
+			ev.time = now;
+			ev.metadata_cache = m_metadata_cache;
+
+			if (options->identity)
+				ev.file_id = m_identities.update(ev);
+
+			if (options->index)
+				m_index.apply(ev);
+
+			std::optional<path_monitor_event> ready;
+
+			if (options->ready and !ev.is_directory and !track_ready(ev, *options, now, ready))
+				return;
+
+			if (options->recursive and ev.is_directory) {
+				follow_subdirectory(ev, *options, now);
+
+				return;
+			}
+
+			if (options->tail and !ev.is_directory)
+				tail(ev, options->priority);
+			else
+				pushback_event(std::move(ev), options->priority);
+
+			if (ready)
+				pushback_event(std::move(*ready), options->priority);
+		});
+
+		if (!parsed)
+			fail_read();
+
+		m_index.publish();
+
+		return parsed;
+	}
+
 	void begin_read()
 	{
 		m_stream_descriptor.async_read_some(boost::asio::buffer(m_read_buffer),
-						    std::bind(&path_monitor_impl::end_read, shared_from_this(),
+						    std::bind(&basic_path_monitor_impl::end_read, this->shared_from_this(),
 							      std::placeholders::_1, std::placeholders::_2));
 	}
 
 private:
-	void end_read(const std::error_code &ec, std::size_t bytes_transferred)
+	static path_monitor_event::type event_type(std::uint32_t mask)
 	{
-		if (!ec) {
-			m_pending_read_buffer += std::string(m_read_buffer.data(), bytes_transferred);
+		switch (mask & 0xFFF) {
+			case IN_MODIFY:
+				return path_monitor_event::type::modified;
 
-			while (m_pending_read_buffer.size() >= sizeof(inotify_event)) {
-				const inotify_event *iev = reinterpret_cast<const inotify_event*>(m_pending_read_buffer.data());
+			case IN_CREATE:
+				return path_monitor_event::type::added;
 
-				if (iev->mask & (IN_UNMOUNT | IN_Q_OVERFLOW | IN_IGNORED)) {
-					m_pending_read_buffer.erase(0, sizeof(inotify_event) + iev->len);
+			case IN_DELETE:
+				return path_monitor_event::type::removed;
 
-					continue;
-				}
+			case IN_MOVED_FROM:
+				return path_monitor_event::type::renamed_old_name;
 
-				auto type = path_monitor_event::type::null;
+			case IN_MOVED_TO:
+				return path_monitor_event::type::renamed_new_name;
 
-				switch (iev->mask & 0xFFF) {
-					case IN_MODIFY:
-						type = path_monitor_event::type::modified;
-						break;
+			case IN_CLOSE_WRITE:
+				return path_monitor_event::type::ready;
 
-					case IN_CREATE:
-						type = path_monitor_event::type::added;
-						break;
+			default:
+				return path_monitor_event::type::null;
+		}
+	}
 
-					case IN_DELETE:
-						type = path_monitor_event::type::removed;
-						break;
+	/// Decode a read straight into the columns of m_batch and hand it to
+	/// the batch sink. Returns false if the records are corrupt.
+	bool consume_batch(const char *data, std::size_t bytes_transferred,
+			   std::chrono::steady_clock::time_point now, event_batch_sink &sink)
+	{
+		auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+		int last_wd = -1;
 
-					case IN_MOVED_FROM:
-						type = path_monitor_event::type::renamed_old_name;
-						break;
+		m_batch.clear();
+
+		bool parsed = m_parser.parse(data, bytes_transferred, [&](const inotify_record_view &r) {
+			if (r.mask & IN_IGNORED) {
+				m_watches.release(r.wd);
+
+				return;
+			}
+
+			if (r.mask & (IN_UNMOUNT | IN_Q_OVERFLOW | IN_DELETE_SELF))
+				return;
+
+			// Resolve each watch once per batch, which also records
+			// activity for the watch budget.
+			if (r.wd != last_wd and m_batch.watch_path(r.wd).empty()) {
+				std::shared_ptr<const watch_options> options;
+
+				m_batch.watch_paths.emplace_back(r.wd, m_watches.touch(r.wd, options));
+			}
+
+			last_wd = r.wd;
+			m_batch.push_back(event_type(r.mask), r.mask & IN_ISDIR, r.wd, r.cookie, time, r.name);
+		});
+
+		if (!parsed) {
+			fail_read();
+			m_index.publish();
+		}
+
+		if (m_batch.empty())
+			return parsed;
+
+		// Event sinks still observe every event, decoded from the batch.
+		{
+			std::unique_lock<mutex_type> lk(m_sinks_mutex);
+
+			for (std::size_t i = 0; !m_sinks.empty() and i < m_batch.size(); ++i) {
+				auto ev = m_batch.event(i);
+
+				ev.metadata_cache = m_metadata_cache;
+
+				for (const auto &s : m_sinks)
+					s->consume(ev);
+			}
+		}
+
+		sink.consume(m_batch);
+
+		return parsed;
+	}
+
+	/// Record that the kernel's records could not be decoded. What followed
+	/// the bad record is lost, so indexed listings are rescanned and the
+	/// consumer is told once it drained the queue.
+	void fail_read()
+	{
+		m_index.invalidate();
+
+		std::function<void()> ready;
+
+		{
+			std::unique_lock<mutex_type> lk(m_events_mutex);
+
+			m_read_error = std::make_error_code(std::errc::bad_message);
+			m_events_cond.notify_all();
+
+			ready.swap(m_ready_handler);
+		}
+
+		if (ready)
+			ready();
+	}
+
+	/// Queue an event about a directory of a recursive path and watch or
+	/// stop watching it. The entries of a new directory are reported as
+	/// added since they may predate its watch.
+	void follow_subdirectory(path_monitor_event &ev, const watch_options &options,
+				 std::chrono::steady_clock::time_point now)
+	{
+		auto parent = ev.parent_path.string();
+		auto name = ev.path.string();
+		auto type = ev.event;
+
+		pushback_event(std::move(ev), options.priority);
+
+		if (type == path_monitor_event::type::added or type == path_monitor_event::type::renamed_new_name) {
+			std::vector<path_monitor_event> events;
+
+			m_watches.add_subdirectory(parent, name, events);
+
+			if (options.index)
+				seed_index(parent + "/" + name);
+
+			for (auto &e : events) {
+				e.time = now;
+				e.metadata_cache = m_metadata_cache;
+				pushback_event(std::move(e), options.priority);
+			}
+		} else if (type == path_monitor_event::type::renamed_old_name) {
+			// The kernel keeps the watches of a moved directory, which
+			// would report under the old name.
+			std::system_error se;
+
+			m_watches.remove(parent + "/" + name, se);
+			m_watches.remove_subdirectories(parent + "/" + name);
+		}
+	}
+
+	/// Index a directory and the watched directories below it.
+	void seed_index(const std::string &dir)
+	{
+		m_index.seed(m_watches.paths(dir));
+	}
+
+	/// Follow the writes to a file of a path reporting ready files. Returns
+	/// false if the event is not to be queued; sets ready to an event to
+	/// queue after it.
+	bool track_ready(const path_monitor_event &ev, const watch_options &options,
+			 std::chrono::steady_clock::time_point now, std::optional<path_monitor_event> &ready)
+	{
+		auto file = (ev.parent_path / ev.path).string();
+
+		switch (ev.event) {
+			case path_monitor_event::type::ready:
+				return m_ready.closed(file);
+
+			case path_monitor_event::type::added:
+			case path_monitor_event::type::modified:
+				if (options.settle != std::chrono::steady_clock::duration::zero() and
+				    m_ready.written(file, now + options.settle, options.priority))
+					begin_settle_wait(now + options.settle);
+
+				break;
+
+			case path_monitor_event::type::renamed_new_name:
+				// Written elsewhere and renamed in place, complete. The
+				// rename itself is queued as usual, tailed if need be.
+				ready.emplace(ev.parent_path, ev.path, path_monitor_event::type::ready);
+				ready->time = now;
+				ready->metadata_cache = m_metadata_cache;
+				m_ready.forget(file);
+				break;
+
+			default:
+				m_ready.forget(file);
+				break;
+		}
+
+		return true;
+	}
+
+	/// Arm the settle timer for an earlier deadline than it waits for.
+	void begin_settle_wait(std::chrono::steady_clock::time_point deadline)
+	{
+		boost::asio::post(m_inotify_io_context, [weak = this->weak_from_this(), deadline]() {
+			if (auto self = weak.lock())
+				self->settle_wait(deadline);
+		});
+	}
+
+	void settle_wait(std::chrono::steady_clock::time_point deadline)
+	{
+		m_settle_timer.expires_at(deadline);
+		m_settle_timer.async_wait([weak = this->weak_from_this()](const boost::system::error_code &ec) {
+			auto self = weak.lock();
+
+			if (ec or !self)
+				return;
+
+			std::vector<std::pair<std::string, watch_priority>> ready;
+			auto now = std::chrono::steady_clock::now();
+			auto next = self->m_ready.expire(now, ready);
+
+			for (auto &f : ready) {
+				std::filesystem::path file(f.first);
+				path_monitor_event ev(file.parent_path(), file.filename(), path_monitor_event::type::ready);
+
+				ev.time = now;
+				ev.metadata_cache = self->m_metadata_cache;
+				self->pushback_event(std::move(ev), f.second);
+			}
+
+			if (next != std::chrono::steady_clock::time_point::max())
+				self->settle_wait(next);
+		});
+	}
+
+	/// Attach the appended bytes to an event of a tailed path and queue it.
+	void tail(path_monitor_event &ev, watch_priority priority)
+	{
+		auto file = ev.path.empty() ? ev.parent_path.string() : (ev.parent_path / ev.path).string();
+
+		switch (ev.event) {
+			case path_monitor_event::type::modified:
+				// A burst of writes yields several events; those finding
+				// nothing new were covered by an earlier read.
+				while ((ev.data = m_tailer.read(file, ev.offset))) {
+					auto more = ev.data->size() == file_tailer::max_chunk;
 
-					case IN_MOVED_TO:
-						type = path_monitor_event::type::renamed_new_name;
+					pushback_event(ev, priority);
+
+					if (!more)
 						break;
 				}
 
-				pushback_event(path_monitor_event(get_dirname(iev->wd), iev->name, type));
+				return;
 
-				m_pending_read_buffer.erase(0, sizeof(inotify_event) + iev->len);
-			}
+			case path_monitor_event::type::renamed_old_name:
+				// Rotation: deliver what was written before the rename
+				// through the descriptor that still refers to the file.
+				ev.data = m_tailer.read(file, ev.offset, false);
+				m_tailer.forget(file);
+				break;
+
+			case path_monitor_event::type::renamed_new_name:
+				m_tailer.moved_in(file);
+				break;
+
+			case path_monitor_event::type::added:
+				m_tailer.created(file);
+				break;
+
+			case path_monitor_event::type::removed:
+				m_tailer.forget(file);
+				break;
+
+			default:
+				break;
+		}
+
+		pushback_event(std::move(ev), priority);
+	}
 
-			begin_read();
+	void end_read(const std::error_code &ec, std::size_t bytes_transferred)
+	{
+		if (!ec) {
+			if (consume_read(m_read_buffer.data(), bytes_transferred))
+				begin_read();
 		} else if (ec != std::errc::operation_canceled) {
 			throw std::system_error(std::error_code(ec.value(), ec.category()), ec.message());
 		}
 	}
 
-	std::string get_dirname(int wd)
+	void notify_sinks(const path_monitor_event &ev)
 	{
-		std::unique_lock<std::mutex> lk(m_watch_descriptors_mutex);
+		std::unique_lock<mutex_type> lk(m_sinks_mutex);
 
-		auto it = m_watch_descriptors.left.find(wd);
+		for (const auto &sink : m_sinks)
+			sink->consume(ev);
+	}
+
+	void begin_snapshot_wait()
+	{
+		m_snapshot_timer.expires_after(m_snapshot_interval);
+		m_snapshot_timer.async_wait([weak = this->weak_from_this()](const boost::system::error_code &ec) {
+			auto self = weak.lock();
+
+			if (ec or !self)
+				return;
 
-		return it != m_watch_descriptors.left.end() ? it->second : "";
+			std::filesystem::path file;
+
+			{
+				std::unique_lock<mutex_type> lk(self->m_events_mutex);
+
+				file = self->m_snapshot_file;
+			}
+
+			std::system_error se;
+
+			self->save_snapshot(file, se);
+			self->begin_snapshot_wait();
+		});
+	}
+
+	std::vector<std::string> watched_directories()
+	{
+		return m_watches.paths();
+	}
+
+	/// Start the poll timer if directories are polled and it is not running.
+	void begin_polling()
+	{
+		if (!m_watches.polling())
+			return;
+
+		boost::asio::post(m_inotify_io_context, [weak = this->weak_from_this()]() {
+			auto self = weak.lock();
+
+			if (self and !self->m_polling) {
+				self->m_polling = true;
+				self->begin_poll_wait();
+			}
+		});
+	}
+
+	void begin_poll_wait()
+	{
+		std::chrono::steady_clock::duration interval;
+
+		{
+			std::unique_lock<mutex_type> lk(m_events_mutex);
+
+			interval = m_poll_interval;
+		}
+
+		m_poll_timer.expires_after(interval);
+		m_poll_timer.async_wait([weak = this->weak_from_this(), interval](const boost::system::error_code &ec) {
+			auto self = weak.lock();
+
+			if (ec or !self)
+				return;
+
+			std::vector<path_monitor_event> events;
+
+			self->m_watches.poll(interval, events);
+
+			auto now = std::chrono::steady_clock::now();
+
+			for (auto &ev : events) {
+				auto priority = self->m_watches.options(ev.parent_path.string())->priority;
+
+				ev.time = now;
+				ev.metadata_cache = self->m_metadata_cache;
+
+				if (self->m_watches.options(ev.parent_path.string())->index)
+					self->m_index.apply(ev);
+
+				self->pushback_event(std::move(ev), priority);
+			}
+
+			self->m_index.publish();
+
+			if (self->m_watches.polling())
+				self->begin_poll_wait();
+			else
+				self->m_polling = false;
+		});
 	}
 
 	std::string m_identifier;
 	int m_fd;
 	boost::asio::io_context m_inotify_io_context;
 	boost::asio::posix::stream_descriptor m_stream_descriptor;
+	boost::asio::steady_timer m_snapshot_timer;
+	std::chrono::steady_clock::duration m_snapshot_interval{};
+	std::filesystem::path m_snapshot_file;
 	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_inotify_work;
 	std::thread m_inotify_work_thread;
 	std::array<char, 4096> m_read_buffer;
-	std::string m_pending_read_buffer;
-	std::mutex m_watch_descriptors_mutex;
-	typedef boost::bimap<int, std::string> watch_descriptors_type;
-	watch_descriptors_type m_watch_descriptors;
-	std::mutex m_events_mutex;
-	std::condition_variable m_events_cond;
+	inotify_parser m_parser;
+	watch_manager m_watches;
+	file_tailer m_tailer;
+	identity_index m_identities;
+	std::shared_ptr<path_metadata_cache> m_metadata_cache = std::make_shared<path_metadata_cache>();
+	boost::asio::steady_timer m_poll_timer;
+	std::chrono::steady_clock::duration m_poll_interval = std::chrono::seconds(1);
+	bool m_polling = false;
+	ready_tracker m_ready;
+	directory_index m_index;
+	boost::asio::steady_timer m_settle_timer;
+	mutex_type m_sinks_mutex;
+	std::vector<std::shared_ptr<path_monitor_event_sink>> m_sinks;
+	std::shared_ptr<event_batch_sink> m_batch_sink;
+	event_batch m_batch;			// Used by the reader only.
+	mutex_type m_events_mutex;
+	typename Policy::threading::condition_type m_events_cond;
+	std::function<void()> m_ready_handler;
 	bool m_run = true;
-	std::deque<path_monitor_event> m_events;
+	std::error_code m_read_error;		// Set once the records are corrupt.
+	queue_type m_events;
 };
 
+/// inotify backend of services::path_monitor.
+typedef basic_path_monitor_impl<> path_monitor_impl;
+
 } // namespace services
 
 #endif // SERVICES_PATH_MONITOR_IMPL_HPP
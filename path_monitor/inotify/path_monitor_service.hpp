@@ -12,11 +12,49 @@
 #ifndef SERVICES_PATH_MONITOR_SERVICE_HPP
 #define SERVICES_PATH_MONITOR_SERVICE_HPP
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "../handler_allocator.hpp"
+#include "../tree_quiescence.hpp"
+#include "io_uring_reader.hpp"
 #include "path_monitor_impl.hpp"
 
 namespace services {
 
 /// Service implementation for the path monitor.
+///
+/// FileMonitorImplementation is the backend producing the events. It is held
+/// by std::shared_ptr and must provide:
+///
+/// - A constructor taking (const std::string &identifier,
+///   std::pmr::memory_resource *resource).
+/// - begin_read(), called once after construction to start producing events.
+/// - destroy(), which stops the backend and makes a blocked popfront_event()
+///   return std::errc::operation_canceled.
+/// - path_monitor_event popfront_event(std::system_error &se), blocking until
+///   an event is queued.
+/// - identifier(), add_path(path, watch_options, se), remove_path(path, se),
+///   save_snapshot(file, se), restore_snapshot(file, se),
+///   set_snapshot(file, interval, se), set_watch_budget(max, interval, se),
+///   stats(), add_sink(sink), remove_sink(sink) and
+///   set_batch_sink(sink, se), list_directory(dir, se) with the semantics of the
+///   basic_path_monitor members of the same names. A backend without the
+///   feature reports std::errc::operation_not_supported.
+/// - popfront_events(std::vector<path_monitor_event> &, std::size_t max, se),
+///   taking queued events without waiting, and bool notify_when_ready(f),
+///   calling f once when events are next queued or the backend destroyed,
+///   for subscriptions.
+/// - int native_handle(), the descriptor to read through io_uring or -1.
+///   Backends returning a descriptor also provide
+///   bool consume_read(const char *, std::size_t) to decode what was read,
+///   false if it is corrupt and the descriptor must not be read again.
+///
+/// path_monitor_impl is the inotify backend, basic_path_monitor_impl<Policy>
+/// the same configured by a path_monitor_policy, synthetic_path_monitor_impl
+/// an in-memory one for load testing.
 template <typename FileMonitorImplementation = path_monitor_impl>
 class path_monitor_service
 	: public boost::asio::io_context::service
@@ -26,7 +64,7 @@ public:
 	static boost::asio::io_context::id id;
 
 	/// The type for an implementation of the path monitor.
-	typedef std::shared_ptr<path_monitor_impl> impl_type;
+	typedef std::shared_ptr<FileMonitorImplementation> impl_type;
 
 	/// Constructor creates a thread to run a private io_context.
 	path_monitor_service(boost::asio::io_context &io_context)
@@ -45,6 +83,7 @@ public:
 	/// Destructor shuts down the private io_context.
 	~path_monitor_service()
 	{
+		m_io_uring.reset();
 		m_work.reset();
 		m_work_io_context.stop();
 
@@ -58,21 +97,72 @@ public:
 	}
 
 	/// Create a new path monitor implementation.
-	void create(impl_type &impl, const std::string &identifier)
+	void create(impl_type &impl, const std::string &identifier,
+		    std::pmr::memory_resource *resource = std::pmr::get_default_resource())
 	{
-		impl = std::make_shared<path_monitor_impl>(identifier);
+		impl = std::make_shared<FileMonitorImplementation>(identifier, resource);
+
+		{
+			std::unique_lock<std::mutex> lk(m_io_uring_mutex);
+
+			if (m_io_uring and m_io_uring->add(impl))
+				return;
+		}
 
 		// begin_read() can't be called within the constructor but must be called
 		// explicitly as it calls shared_from_this().
 		impl->begin_read();
 	}
 
+	/// Read the inotify descriptors of monitors created from now on through a
+	/// shared io_uring instead of each monitor's epoll reactor. Fails if the
+	/// kernel does not support io_uring, in which case nothing changes.
+	void enable_io_uring(std::system_error &se)
+	{
+		std::unique_lock<std::mutex> lk(m_io_uring_mutex);
+
+		if (!m_io_uring) {
+			try {
+				m_io_uring = std::make_shared<io_uring_reader<FileMonitorImplementation>>();
+			} catch (const std::system_error &e) {
+				se = e;
+
+				return;
+			}
+		}
+
+		se = operation_succeeded();
+	}
+
 	/// Destroy a path monitor implementation.
 	void destroy(impl_type &impl)
 	{
 		if (!impl)
 			return;
 
+		{
+			std::unique_lock<std::mutex> lk(m_io_uring_mutex);
+
+			if (m_io_uring)
+				m_io_uring->remove(impl);
+		}
+
+		std::shared_ptr<tree_quiescence> quiescence;
+
+		{
+			std::unique_lock<std::mutex> lk(m_quiescence_mutex);
+
+			auto it = m_quiescence.find(impl.get());
+
+			if (it != m_quiescence.end()) {
+				quiescence = it->second;
+				m_quiescence.erase(it);
+			}
+		}
+
+		if (quiescence)
+			quiescence->cancel();
+
 		// If an asynchronous call is currently waiting for an event
 		// we must interrupt the blocked call to make sure it returns.
 		impl->destroy();
@@ -86,9 +176,10 @@ public:
 	}
 
 	/// Add path to monitor.
-	void add_path(impl_type &impl, const std::filesystem::path &path, std::system_error &se)
+	void add_path(impl_type &impl, const std::filesystem::path &path, const watch_options &options,
+		      std::system_error &se)
 	{
-		impl->add_path(path, se);
+		impl->add_path(path, options, se);
 	}
 
 	/// Remove path from monitor.
@@ -97,22 +188,83 @@ public:
 		impl->remove_path(path, se);
 	}
 
+	/// Save a snapshot of the watched directories.
+	void save_snapshot(impl_type &impl, const std::filesystem::path &file, std::system_error &se)
+	{
+		impl->save_snapshot(file, se);
+	}
+
+	/// Queue the changes made since a snapshot was saved.
+	void restore_snapshot(impl_type &impl, const std::filesystem::path &file, std::system_error &se)
+	{
+		impl->restore_snapshot(file, se);
+	}
+
+	/// Save snapshots on destruction and periodically.
+	void set_snapshot(impl_type &impl, const std::filesystem::path &file,
+			  std::chrono::steady_clock::duration interval, std::system_error &se)
+	{
+		impl->set_snapshot(file, interval, se);
+	}
+
+	/// Limit the number of inotify watches.
+	void set_watch_budget(impl_type &impl, std::size_t max_watches,
+			      std::chrono::steady_clock::duration poll_interval, std::system_error &se)
+	{
+		impl->set_watch_budget(max_watches, poll_interval, se);
+	}
+
+	/// Return counters describing the monitor.
+	path_monitor_stats stats(impl_type &impl)
+	{
+		return impl->stats();
+	}
+
+	/// Deliver events in columnar batches instead of queueing them.
+	void set_batch_sink(impl_type &impl, std::shared_ptr<event_batch_sink> sink, std::system_error &se)
+	{
+		impl->set_batch_sink(sink, se);
+	}
+
+	/// Return the indexed entries of a directory.
+	std::shared_ptr<const directory_listing> list_directory(impl_type &impl, const std::filesystem::path &dir,
+								 std::system_error &se)
+	{
+		return impl->list_directory(dir, se);
+	}
+
+	/// Attach an event sink.
+	void add_sink(impl_type &impl, std::shared_ptr<path_monitor_event_sink> sink)
+	{
+		impl->add_sink(sink);
+	}
+
+	/// Detach an event sink.
+	void remove_sink(impl_type &impl, std::shared_ptr<path_monitor_event_sink> sink)
+	{
+		impl->remove_sink(sink);
+	}
+
 	/// Monitor path events synchronously.
 	path_monitor_event monitor(impl_type &impl, std::system_error &se)
 	{
 		return impl->popfront_event(se);
 	}
 
-	/// Class to facilitate monitoring operations asynchronously.
+	/// Class to facilitate monitoring operations asynchronously. The
+	/// operation and the completion it posts allocate through the allocator
+	/// associated with the handler, see make_recycling_handler().
 	template <typename Handler>
 	class monitor_operation
 	{
 	public:
+		typedef typename boost::asio::associated_allocator<Handler>::type allocator_type;
+
 		monitor_operation(impl_type impl, boost::asio::io_context &io_context, Handler handler)
 			: m_impl(impl),
 			m_io_context(io_context),
 			m_work(boost::asio::make_work_guard(io_context)),
-			m_handler(handler)
+			m_handler(std::move(handler))
 		{
 		}
 
@@ -121,26 +273,65 @@ public:
 			m_work.reset();
 		}
 
-		void operator()() const
+		allocator_type get_allocator() const noexcept
+		{
+			return boost::asio::get_associated_allocator(m_handler);
+		}
+
+		void operator()()
 		{
 			auto impl = m_impl.lock();
 
 			if (impl) {
-				std::system_error se;
-
+				auto se = operation_succeeded();
 				auto ev = impl->popfront_event(se);
 
-				this->m_io_context.post(boost::asio::detail::bind_handler(m_handler, se, ev));
+				this->m_io_context.post(completion(std::move(m_handler), se, std::move(ev)));
 			} else {
-				this->m_io_context.post(boost::asio::detail::bind_handler(
-					m_handler,
-					std::system_error(std::error_code(static_cast<int>(std::errc::operation_canceled), std::system_category()),
-							  "service::path_monitor_service::monitor_operation: operation canceled"),
-							  path_monitor_event()));
+				this->m_io_context.post(completion(std::move(m_handler), canceled(), path_monitor_event()));
 			}
 		}
 
 	private:
+		/// The handler bound to its arguments. Unlike asio's binders it
+		/// moves the event in and out and keeps the handler's allocator.
+		class completion
+		{
+		public:
+			typedef typename boost::asio::associated_allocator<Handler>::type allocator_type;
+
+			completion(Handler handler, const std::system_error &se, path_monitor_event ev)
+				: m_handler(std::move(handler)),
+				m_se(se),
+				m_ev(std::move(ev))
+			{
+			}
+
+			allocator_type get_allocator() const noexcept
+			{
+				return boost::asio::get_associated_allocator(m_handler);
+			}
+
+			void operator()()
+			{
+				m_handler(static_cast<const std::system_error&>(m_se), std::move(m_ev));
+			}
+
+		private:
+			Handler m_handler;
+			std::system_error m_se;
+			path_monitor_event m_ev;
+		};
+
+		/// Built once, see operation_succeeded().
+		static const std::system_error& canceled()
+		{
+			static const std::system_error se(std::error_code(static_cast<int>(std::errc::operation_canceled), std::system_category()),
+							  "service::path_monitor_service::monitor_operation: operation canceled");
+
+			return se;
+		}
+
 		std::weak_ptr<FileMonitorImplementation> m_impl;
 		boost::asio::io_context &m_io_context;
 
@@ -156,7 +347,151 @@ public:
 	template <typename Handler>
 	void async_monitor(impl_type &impl, Handler handler)
 	{
-		m_work_io_context.post(monitor_operation<Handler>(impl, m_work_io_context, handler));
+		m_work_io_context.post(monitor_operation<Handler>(impl, m_work_io_context, std::move(handler)));
+	}
+
+	/// A subscription emptying the queue of a monitor in batches on the
+	/// private io_context. It is scheduled when events are queued, as told
+	/// by the backend's notify_when_ready(), instead of blocking the thread
+	/// in popfront_event() between events.
+	template <typename Handler>
+	class subscription_operation
+		: public path_monitor_subscription::state,
+		public std::enable_shared_from_this<subscription_operation<Handler>>
+	{
+	public:
+		/// Events taken from the queue per run, so that other operations
+		/// of the io_context get the thread in between.
+		static constexpr std::size_t batch_size = 256;
+
+		subscription_operation(impl_type impl, boost::asio::io_context &io_context, Handler handler)
+			: m_impl(impl),
+			m_io_context(io_context),
+			m_work(boost::asio::make_work_guard(io_context)),
+			m_handler(std::move(handler))
+		{
+			m_batch.reserve(batch_size);
+		}
+
+		void start()
+		{
+			schedule();
+		}
+
+		/// Events already taken from the queue, at most batch_size, are
+		/// still delivered.
+		void cancel() override
+		{
+			m_canceled = true;
+			schedule();
+		}
+
+		bool active() const override
+		{
+			return m_active;
+		}
+
+	private:
+		void schedule()
+		{
+			boost::asio::post(m_io_context, [self = this->shared_from_this()]() {
+				self->run();
+			});
+		}
+
+		void run()
+		{
+			if (!m_active)
+				return;
+
+			auto impl = m_impl.lock();
+
+			if (!impl or m_canceled) {
+				finish();
+
+				return;
+			}
+
+			auto se = operation_succeeded();
+
+			impl->popfront_events(m_batch, batch_size, se);
+
+			if (se.code()) {
+				finish();
+
+				return;
+			}
+
+			for (auto &ev : m_batch)
+				m_handler(operation_succeeded(), std::move(ev));
+
+			m_batch.clear();
+
+			if (m_canceled) {
+				finish();
+
+				return;
+			}
+
+			// The callback keeps the subscription alive while it waits.
+			if (!impl->notify_when_ready([self = this->shared_from_this()]() { self->schedule(); }))
+				schedule();
+		}
+
+		void finish()
+		{
+			static const std::system_error canceled(
+				std::error_code(static_cast<int>(std::errc::operation_canceled), std::system_category()),
+				"service::path_monitor_service::subscription_operation: operation canceled");
+
+			m_active = false;
+			m_handler(canceled, path_monitor_event());
+			m_work.reset();
+		}
+
+		std::weak_ptr<FileMonitorImplementation> m_impl;
+		boost::asio::io_context &m_io_context;
+		boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+		Handler m_handler;
+		std::vector<path_monitor_event> m_batch;
+		std::atomic<bool> m_canceled{ false };
+		std::atomic<bool> m_active{ true };
+	};
+
+	/// Deliver every event to handler until cancelled or destroyed.
+	template <typename Handler>
+	path_monitor_subscription subscribe(impl_type &impl, Handler handler)
+	{
+		auto op = std::make_shared<subscription_operation<Handler>>(impl, m_work_io_context, std::move(handler));
+
+		op->start();
+
+		return path_monitor_subscription(op);
+	}
+
+	/// Wait for a path and the paths below it to stop changing. Completes
+	/// on the io_context owning the service, whose timers are not held up
+	/// by blocked async_monitor() operations.
+	template <typename Handler>
+	void async_wait_quiet(impl_type &impl, const std::filesystem::path &path,
+			      std::chrono::steady_clock::duration quiet, Handler handler)
+	{
+		std::shared_ptr<tree_quiescence> quiescence;
+
+		{
+			std::unique_lock<std::mutex> lk(m_quiescence_mutex);
+
+			auto &q = m_quiescence[impl.get()];
+
+			if (!q) {
+				q = std::make_shared<tree_quiescence>(this->get_io_context());
+				impl->add_sink(q);
+			}
+
+			quiescence = q;
+		}
+
+		quiescence->async_wait(path, quiet, std::move(handler));
 	}
 
 private:
@@ -170,6 +505,14 @@ private:
 
 	/// Thread used for running the work io_context's run loop.
 	std::shared_ptr<std::thread> m_work_thread;
+
+	/// Shared io_uring read path, null while monitors use epoll.
+	std::mutex m_io_uring_mutex;
+	std::shared_ptr<io_uring_reader<FileMonitorImplementation>> m_io_uring;
+
+	/// Quiescence waits by monitor, created on first use.
+	std::mutex m_quiescence_mutex;
+	std::map<const FileMonitorImplementation*, std::shared_ptr<tree_quiescence>> m_quiescence;
 };
 
 template <typename FileMonitorImplementation>
@@ -0,0 +1,135 @@
+//
+// ready_tracker.hpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_READY_TRACKER_HPP
+#define SERVICES_READY_TRACKER_HPP
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../basic_path_monitor.hpp"
+
+namespace services {
+
+/// Decides when files of paths watched with watch_options::ready are
+/// complete: when closed after writing, or when a writer holding the file
+/// open has been quiet for the settle period. A file is reported once per
+/// series of writes. The owner runs one timer, armed for the earliest
+/// deadline only when it moves earlier.
+class ready_tracker
+{
+public:
+	typedef std::chrono::steady_clock clock_type;
+
+	ready_tracker() = default;
+
+	ready_tracker(const ready_tracker &) = delete;
+	ready_tracker& operator=(const ready_tracker &) = delete;
+
+	/// Record a write. Returns true if the timer must be armed for deadline.
+	bool written(const std::string &file, clock_type::time_point deadline, watch_priority priority)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		m_files[file] = pending{ deadline, priority, false };
+
+		if (deadline >= m_armed)
+			return false;
+
+		m_armed = deadline;
+
+		return true;
+	}
+
+	/// Record a writer closing the file. Returns true if it is to be
+	/// reported, false if the settle period already reported the writes.
+	bool closed(const std::string &file)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto it = m_files.find(file);
+
+		if (it == m_files.end())
+			return true;
+
+		bool report = !it->second.reported;
+
+		m_files.erase(it);
+
+		return report;
+	}
+
+	/// Forget a file that was removed or renamed away.
+	void forget(const std::string &file)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		m_files.erase(file);
+	}
+
+	/// Forget the files of a directory.
+	void forget_directory(const std::string &dir)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto prefix = dir + "/";
+
+		for (auto it = m_files.begin(); it != m_files.end();) {
+			if (it->first.compare(0, prefix.size(), prefix) == 0)
+				it = m_files.erase(it);
+			else
+				++it;
+		}
+	}
+
+	/// Append the files quiet since their deadline to ready and return the
+	/// next deadline the timer must be armed for, max() if none.
+	clock_type::time_point expire(clock_type::time_point now,
+				      std::vector<std::pair<std::string, watch_priority>> &ready)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		m_armed = clock_type::time_point::max();
+
+		for (auto &f : m_files) {
+			if (f.second.reported)
+				continue;
+
+			if (f.second.deadline <= now) {
+				f.second.reported = true;
+				ready.emplace_back(f.first, f.second.priority);
+			} else if (f.second.deadline < m_armed) {
+				m_armed = f.second.deadline;
+			}
+		}
+
+		return m_armed;
+	}
+
+private:
+	struct pending
+	{
+		clock_type::time_point deadline;
+		watch_priority priority;
+		bool reported;		// Kept until closed to suppress a second report.
+	};
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, pending> m_files;
+	clock_type::time_point m_armed = clock_type::time_point::max();
+};
+
+} // namespace services
+
+#endif // SERVICES_READY_TRACKER_HPP
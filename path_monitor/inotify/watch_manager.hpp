@@ -0,0 +1,565 @@
+//
+// watch_manager.hpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_WATCH_MANAGER_HPP
+#define SERVICES_WATCH_MANAGER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fnmatch.h>
+
+#include "../basic_path_monitor.hpp"
+#include "../tree_snapshot.hpp"
+
+namespace services {
+
+/// Registry of the paths a monitor watches. It keeps the number of inotify
+/// watches within a budget by demoting the least recently active directories
+/// to polling and promotes polled directories back when they change.
+class watch_manager
+{
+public:
+	typedef std::chrono::steady_clock clock_type;
+
+	/// Events requested for every inotify watch, with IN_CLOSE_WRITE for
+	/// paths reporting ready files.
+	static constexpr std::uint32_t watch_mask = IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVE | IN_DELETE_SELF;
+
+	explicit watch_manager(int fd)
+		: m_fd(fd)
+	{
+	}
+
+	watch_manager(const watch_manager &) = delete;
+	watch_manager& operator=(const watch_manager &) = delete;
+
+	/// Watch a path. When the budget or the kernel's max_user_watches limit
+	/// is reached the least recently active directory is demoted to polling
+	/// to make room; if nothing can be demoted the new directory is polled.
+	/// A recursive path also watches its subdirectories except excluded
+	/// ones, whose subtrees are not walked.
+	void add(const std::string &path, const watch_options &options, std::system_error &se)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		if (m_watches.count(path)) {
+			se = operation_succeeded();
+
+			return;
+		}
+
+		auto shared = std::make_shared<const watch_options>(options);
+		std::error_code ec;
+
+		if (!add_one(path, shared, path, ec)) {
+			se = std::system_error(ec, "service::watch_manager::add: inotify_add_watch for \"" + path + "\" path failed");
+
+			return;
+		}
+
+		if (options.recursive)
+			walk(path, shared, path, nullptr);
+
+		se = operation_succeeded();
+	}
+
+	/// Watch a directory that appeared in a recursively watched one unless
+	/// it is excluded, with its subdirectories. Entries created before the
+	/// watches were in place are appended to events as added.
+	void add_subdirectory(const std::string &parent, const std::string &name,
+			      std::vector<path_monitor_event> &events)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto it = m_watches.find(parent);
+
+		if (it == m_watches.end() or !it->second.options->recursive)
+			return;
+
+		auto options = it->second.options;
+		auto root = it->second.root;
+		auto path = parent + "/" + name;
+		std::error_code ec;
+
+		if (excluded(*options, root, path) or !add_one(path, options, root, ec))
+			return;
+
+		walk(path, options, root, &events);
+	}
+
+	/// Stop watching a path, and for a recursive path its subdirectories.
+	void remove(const std::string &path, std::system_error &se)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto it = m_watches.find(path);
+
+		if (it != m_watches.end()) {
+			if (owns_descriptor(it->second) and inotify_rm_watch(m_fd, it->second.wd) == -1) {
+				se = std::system_error(std::error_code(errno, std::system_category()),
+						       "service::watch_manager::remove: inotify_rm_watch for \"" + path + "\" path failed");
+
+				return;
+			}
+
+			if (it->second.options->recursive and it->second.root == path)
+				erase_subdirectories(path);
+
+			deactivate(it->second);
+			m_watches.erase(it);
+		}
+
+		se = operation_succeeded();
+	}
+
+	/// Stop watching the subdirectories of a directory that was moved away
+	/// or removed.
+	void remove_subdirectories(const std::string &path)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		erase_subdirectories(path);
+	}
+
+	/// Return the path and options of a watch descriptor, an empty path if
+	/// unknown, and record activity on it.
+	std::string touch(int wd, std::shared_ptr<const watch_options> &options)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto it = m_descriptors.find(wd);
+
+		if (it == m_descriptors.end()) {
+			options = default_options();
+
+			return std::string();
+		}
+
+		auto *w = it->second;
+
+		w->last_activity = clock_type::now();
+		m_lru.splice(m_lru.end(), m_lru, w->lru);
+		options = w->options;
+
+		return w->path;
+	}
+
+	/// Return the options of a watched path, defaults if not watched.
+	std::shared_ptr<const watch_options> options(const std::string &path)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto it = m_watches.find(path);
+
+		return it == m_watches.end() ? default_options() : it->second.options;
+	}
+
+	/// Forget a watch the kernel removed, on IN_IGNORED after the watched
+	/// directory was deleted or unmounted. Returns the path of the watch,
+	/// empty if it was not known.
+	std::string release(int wd)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto it = m_descriptors.find(wd);
+
+		if (it == m_descriptors.end())
+			return std::string();
+
+		auto path = it->second->path;
+
+		deactivate(*it->second);
+		m_watches.erase(path);
+
+		return path;
+	}
+
+	/// Limit the number of inotify watches; zero means no limit other than
+	/// the kernel's. Excess watches are demoted immediately.
+	void set_budget(std::size_t budget)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		m_budget = budget;
+
+		while (m_budget and m_lru.size() > m_budget and evict(nullptr))
+			;
+	}
+
+	/// Rescan polled directories, append the events that turn their previous
+	/// state into the current one and promote those that changed back to
+	/// inotify if room can be made.
+	void poll(clock_type::duration idle, std::vector<path_monitor_event> &events)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto now = clock_type::now();
+
+		for (auto it = m_watches.begin(); it != m_watches.end();) {
+			auto &w = it->second;
+
+			if (w.wd >= 0) {
+				++it;
+
+				continue;
+			}
+
+			std::error_code ec;
+			auto state = scan_directory(w.path, ec);
+
+			if (ec and ec != std::errc::no_such_file_or_directory) {
+				++it;
+
+				continue;
+			}
+
+			std::vector<tree_snapshot::entry_view> previous;
+
+			previous.reserve(w.state.size());
+
+			for (const auto &e : w.state)
+				previous.push_back(tree_snapshot::entry_view{ e.name, e.inode, e.size, e.mtime });
+
+			auto count = events.size();
+
+			tree_snapshot::diff(w.path, previous, state, events);
+
+			// A polled directory that disappeared is dropped like an
+			// inotify watch receiving IN_IGNORED.
+			if (ec) {
+				it = m_watches.erase(it);
+
+				continue;
+			}
+
+			w.state = std::move(state);
+
+			if (events.size() != count) {
+				w.last_activity = now;
+
+				// Only displace a watch that has been idle for a while so
+				// that two busy directories do not keep trading places.
+				bool room = !m_budget or m_lru.size() < m_budget or
+					    m_lru.front()->last_activity + idle <= now;
+
+				std::error_code ignored;
+
+				if (room and activate(w, ignored))
+					++m_promotions;
+			}
+
+			++it;
+		}
+	}
+
+	/// Return true if any path is being polled.
+	bool polling()
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		for (const auto &w : m_watches) {
+			if (w.second.wd < 0)
+				return true;
+		}
+
+		return false;
+	}
+
+	/// Return all watched paths.
+	std::vector<std::string> paths()
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		std::vector<std::string> paths;
+
+		for (const auto &w : m_watches)
+			paths.push_back(w.first);
+
+		return paths;
+	}
+
+	/// Return the watched paths at and below dir.
+	std::vector<std::string> paths(const std::string &dir)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		std::vector<std::string> paths;
+		auto prefix = dir + "/";
+
+		if (m_watches.count(dir))
+			paths.push_back(dir);
+
+		for (auto it = m_watches.lower_bound(prefix); it != m_watches.end() and
+		     it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+			paths.push_back(it->first);
+
+		return paths;
+	}
+
+	void stats(path_monitor_stats &s)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		s.watches = m_lru.size();
+		s.polled_watches = 0;
+
+		for (const auto &w : m_watches)
+			s.polled_watches += w.second.wd < 0;
+
+		s.evictions = m_evictions;
+		s.promotions = m_promotions;
+	}
+
+private:
+	struct watch
+	{
+		std::string path;
+		std::string root;				// Path added by the user.
+		std::shared_ptr<const watch_options> options;	// Shared by a recursive tree.
+		int wd = -1;					// -1 while polled.
+		bool directory = false;
+		clock_type::time_point last_activity;
+		std::list<watch*>::iterator lru;
+		std::vector<directory_entry_state> state;	// Last polled state.
+	};
+
+	static std::shared_ptr<const watch_options> default_options()
+	{
+		static const auto options = std::make_shared<const watch_options>();
+
+		return options;
+	}
+
+	/// Register and watch one path, falling back to polling a directory
+	/// when no watch can be had.
+	bool add_one(const std::string &path, const std::shared_ptr<const watch_options> &options,
+		     const std::string &root, std::error_code &ec)
+	{
+		auto &w = m_watches[path];
+
+		w.path = path;
+		w.root = root;
+		w.options = options;
+		w.directory = std::filesystem::is_directory(path, ec);
+
+		if (activate(w, ec))
+			return true;
+
+		if (ec == std::errc::no_space_on_device and w.directory) {
+			w.state = scan_directory(path, ec);
+
+			if (!ec)
+				return true;
+		}
+
+		m_watches.erase(path);
+
+		return false;
+	}
+
+	/// Watch the subdirectories below path, skipping excluded ones and
+	/// symbolic links. When events is given the entries found are appended
+	/// to it as added, for directories that were created with content
+	/// before their watch existed.
+	void walk(const std::string &path, const std::shared_ptr<const watch_options> &options,
+		  const std::string &root, std::vector<path_monitor_event> *events)
+	{
+		std::vector<std::string> pending{ path };
+
+		while (!pending.empty()) {
+			auto dir = std::move(pending.back());
+
+			pending.pop_back();
+
+			DIR *d = ::opendir(dir.c_str());
+
+			if (!d)
+				continue;
+
+			while (auto *e = ::readdir(d)) {
+				if (e->d_name[0] == '.' and (!e->d_name[1] or (e->d_name[1] == '.' and !e->d_name[2])))
+					continue;
+
+				auto child = dir + "/" + e->d_name;
+				bool is_dir = e->d_type == DT_DIR;
+
+				if (e->d_type == DT_UNKNOWN) {
+					struct stat st;
+
+					is_dir = ::lstat(child.c_str(), &st) == 0 and S_ISDIR(st.st_mode);
+				}
+
+				if (is_dir and excluded(*options, root, child))
+					continue;
+
+				if (events) {
+					path_monitor_event ev(dir, e->d_name, path_monitor_event::type::added);
+
+					ev.is_directory = is_dir;
+					events->push_back(std::move(ev));
+				}
+
+				std::error_code ec;
+
+				if (is_dir and !m_watches.count(child) and add_one(child, options, root, ec))
+					pending.push_back(std::move(child));
+			}
+
+			::closedir(d);
+		}
+	}
+
+	/// Return true if an exclusion pattern matches a directory below root:
+	/// a pattern holding a slash is matched against the path relative to
+	/// root, any other against the directory name.
+	static bool excluded(const watch_options &options, const std::string &root, const std::string &path)
+	{
+		if (options.exclude.empty() or path.size() <= root.size())
+			return false;
+
+		auto relative = path.substr(root.size() + 1);
+		auto name = path.substr(path.rfind('/') + 1);
+
+		for (const auto &pattern : options.exclude) {
+			bool anchored = pattern.find('/') != std::string::npos;
+
+			if (::fnmatch(pattern.c_str(), (anchored ? relative : name).c_str(), 0) == 0)
+				return true;
+		}
+
+		return false;
+	}
+
+	/// Stop watching every path below path.
+	void erase_subdirectories(const std::string &path)
+	{
+		auto prefix = path + "/";
+
+		for (auto it = m_watches.lower_bound(prefix); it != m_watches.end() and
+		     it->first.compare(0, prefix.size(), prefix) == 0;) {
+			if (owns_descriptor(it->second))
+				inotify_rm_watch(m_fd, it->second.wd);
+
+			deactivate(it->second);
+			it = m_watches.erase(it);
+		}
+	}
+
+	/// Start watching with inotify, evicting other watches if necessary.
+	bool activate(watch &w, std::error_code &ec)
+	{
+		if (m_budget and m_lru.size() >= m_budget and !evict(&w)) {
+			ec = std::make_error_code(std::errc::no_space_on_device);
+
+			return false;
+		}
+
+		int wd;
+
+		std::uint32_t mask = watch_mask | (w.options->ready ? IN_CLOSE_WRITE : 0);
+
+		while ((wd = inotify_add_watch(m_fd, w.path.c_str(), mask)) == -1) {
+			int error = errno;
+
+			if (error != ENOSPC or !evict(&w)) {
+				ec = std::error_code(error, std::system_category());
+
+				return false;
+			}
+		}
+
+		w.wd = wd;
+
+		// Another path naming the same inode already owns the descriptor.
+		if (m_descriptors.count(wd)) {
+			ec = std::error_code();
+
+			return true;
+		}
+
+		w.last_activity = clock_type::now();
+		w.lru = m_lru.insert(m_lru.end(), &w);
+		w.state.clear();
+		w.state.shrink_to_fit();
+
+		m_descriptors[wd] = &w;
+
+		return true;
+	}
+
+	bool owns_descriptor(const watch &w) const
+	{
+		auto it = m_descriptors.find(w.wd);
+
+		return it != m_descriptors.end() and it->second == &w;
+	}
+
+	/// Drop the bookkeeping of an inotify watch.
+	void deactivate(watch &w)
+	{
+		if (owns_descriptor(w)) {
+			m_descriptors.erase(w.wd);
+			m_lru.erase(w.lru);
+		}
+
+		w.wd = -1;
+	}
+
+	/// Demote the least recently active directory to polling.
+	bool evict(const watch *keep)
+	{
+		for (auto *w : m_lru) {
+			if (w == keep or !w->directory)
+				continue;
+
+			std::error_code ec;
+
+			// Record the baseline before the watch goes away so that changes
+			// in between are reported by the next poll.
+			w->state = scan_directory(w->path, ec);
+
+			inotify_rm_watch(m_fd, w->wd);
+			deactivate(*w);
+
+			++m_evictions;
+
+			return true;
+		}
+
+		return false;
+	}
+
+	std::mutex m_mutex;
+	int m_fd;
+	std::size_t m_budget = 0;
+	std::map<std::string, watch> m_watches;
+	std::unordered_map<int, watch*> m_descriptors;
+	std::list<watch*> m_lru;		// Inotify watches, least recently active first.
+	std::size_t m_evictions = 0;
+	std::size_t m_promotions = 0;
+};
+
+} // namespace services
+
+#endif // SERVICES_WATCH_MANAGER_HPP
@@ -0,0 +1,178 @@
+//
+// path_metadata.hpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_PATH_METADATA_HPP
+#define SERVICES_PATH_METADATA_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+namespace services {
+
+/// Metadata of a directory entry, symbolic links not followed.
+struct path_metadata
+{
+	std::uint64_t device = 0;
+	std::uint64_t inode = 0;
+	std::uint64_t size = 0;
+	std::int64_t mtime = 0;		// Nanoseconds since epoch.
+	bool is_directory = false;
+};
+
+/// Short-lived cache of directory entry metadata shared by the events of a
+/// monitor. An entry answers for every event read before it was fetched, so
+/// a burst of events on one file costs one statx() however many of them are
+/// handled; events read later fetch again. Each directory keeps a descriptor
+/// open while it has entries and entries are dropped after ttl.
+class path_metadata_cache
+{
+public:
+	typedef std::chrono::steady_clock clock_type;
+
+	explicit path_metadata_cache(clock_type::duration ttl = std::chrono::milliseconds(100))
+		: m_ttl(ttl)
+	{
+	}
+
+	path_metadata_cache(const path_metadata_cache &) = delete;
+	path_metadata_cache& operator=(const path_metadata_cache &) = delete;
+
+	~path_metadata_cache()
+	{
+		for (auto &d : m_directories)
+			::close(d.second.fd);
+	}
+
+	/// Return the metadata of name in directory as of no earlier than time.
+	path_metadata lookup(const std::filesystem::path &directory, const std::filesystem::path &name,
+			     clock_type::time_point time, std::error_code &ec)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		auto now = clock_type::now();
+
+		if (now - m_last_prune >= m_ttl)
+			prune(now);
+
+		auto dit = m_directories.find(directory.native());
+
+		if (dit == m_directories.end()) {
+			int fd = ::open(directory.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+			if (fd == -1) {
+				ec = std::error_code(errno, std::system_category());
+
+				return path_metadata();
+			}
+
+			dit = m_directories.emplace(directory.native(), cached_directory{ fd, {} }).first;
+		}
+
+		auto &entries = dit->second.entries;
+		auto eit = entries.find(name.native());
+
+		if (eit != entries.end() and eit->second.fetched >= time) {
+			ec = std::error_code();
+
+			return eit->second.metadata;
+		}
+
+		path_metadata m;
+
+		if (!fetch(dit->second.fd, name.empty() ? "" : name.c_str(), m, ec))
+			return m;
+
+		entries[name.native()] = cached_entry{ m, now };
+
+		return m;
+	}
+
+	/// Fetch metadata without a cache, relative to dirfd unless path is
+	/// absolute or dirfd is AT_FDCWD. An empty path names dirfd itself.
+	static bool fetch(int dirfd, const char *path, path_metadata &m, std::error_code &ec)
+	{
+		struct statx stx;
+
+		int flags = AT_SYMLINK_NOFOLLOW | (*path ? 0 : AT_EMPTY_PATH);
+
+		if (::statx(dirfd, path, flags, STATX_TYPE | STATX_INO | STATX_SIZE | STATX_MTIME, &stx) == -1) {
+			ec = std::error_code(errno, std::system_category());
+
+			return false;
+		}
+
+		m.device = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+		m.inode = stx.stx_ino;
+		m.size = stx.stx_size;
+		m.mtime = std::int64_t(stx.stx_mtime.tv_sec) * 1000000000 + stx.stx_mtime.tv_nsec;
+		m.is_directory = S_ISDIR(stx.stx_mode);
+
+		ec = std::error_code();
+
+		return true;
+	}
+
+private:
+	struct cached_entry
+	{
+		path_metadata metadata;
+		clock_type::time_point fetched;
+	};
+
+	struct cached_directory
+	{
+		int fd;
+		std::map<std::string, cached_entry> entries;
+	};
+
+	/// Drop expired entries and the directories left without any.
+	void prune(clock_type::time_point now)
+	{
+		for (auto dit = m_directories.begin(); dit != m_directories.end();) {
+			auto &entries = dit->second.entries;
+
+			for (auto eit = entries.begin(); eit != entries.end();) {
+				if (eit->second.fetched + m_ttl <= now)
+					eit = entries.erase(eit);
+				else
+					++eit;
+			}
+
+			if (entries.empty()) {
+				::close(dit->second.fd);
+				dit = m_directories.erase(dit);
+			} else {
+				++dit;
+			}
+		}
+
+		m_last_prune = now;
+	}
+
+	std::mutex m_mutex;
+	clock_type::duration m_ttl;
+	clock_type::time_point m_last_prune;
+	std::map<std::string, cached_directory> m_directories;
+};
+
+} // namespace services
+
+#endif // SERVICES_PATH_METADATA_HPP
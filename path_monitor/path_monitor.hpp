@@ -24,6 +24,14 @@ namespace services {
 /// Typedef for typical path monitor usage.
 typedef basic_path_monitor< path_monitor_service<> > path_monitor;
 
+/// Path monitor configured at compile time, see path_monitor_policy.
+template <typename Policy>
+using basic_policy_path_monitor = basic_path_monitor< path_monitor_service< basic_path_monitor_impl<Policy> > >;
+
+/// Path monitor for synchronous use from one thread: no reader thread or
+/// locking of its queue and events in arrival order.
+typedef basic_policy_path_monitor<minimal_path_monitor_policy> single_threaded_path_monitor;
+
 } // namespace services
 
 #endif // SERVICES_PATH_MONITOR_HPP
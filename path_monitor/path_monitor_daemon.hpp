@@ -0,0 +1,890 @@
+//
+// path_monitor_daemon.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_PATH_MONITOR_DAEMON_HPP
+#define SERVICES_PATH_MONITOR_DAEMON_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#define BOOST_ERROR_CODE_HEADER_ONLY
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include "path_monitor.hpp"
+
+namespace services {
+
+/// Wire format shared by path_monitor_daemon and path_monitor_client. Every
+/// message is a frame of a 32 bit payload length followed by the payload,
+/// whose first byte is the message type. Integers are native endian; both
+/// ends live on the same host.
+///
+/// subscribe:	u32 id, u32 mask, u16 path length, path, u16 filter length, filter
+/// unsubscribe:	u32 id
+/// subscribed:	u32 id, i32 errno
+/// event:	u32 id, u8 type, u16 name length, name
+/// overflow:	(empty) events were dropped because the client fell behind
+///
+/// A frame longer than max_frame_size ends the connection.
+namespace path_monitor_protocol {
+
+/// Largest payload accepted, room for a subscribe with the longest path and
+/// filter.
+constexpr std::uint32_t max_frame_size = 256 * 1024;
+
+/// Convert an Asio error. System errors map to std::system_category like
+/// errno values elsewhere; others, such as end of file, keep their own.
+inline std::error_code to_error_code(const boost::system::error_code &ec)
+{
+	if (ec.category() == boost::system::system_category())
+		return std::error_code(ec.value(), std::system_category());
+
+	return ec;
+}
+
+enum class message : std::uint8_t
+{
+	subscribe = 1,
+	unsubscribe = 2,
+	subscribed = 3,
+	event = 4,
+	overflow = 5
+};
+
+/// Subscription mask selecting every event type.
+constexpr std::uint32_t all_events = 0xFFFFFFFF;
+
+/// Subscription mask bit for an event type.
+constexpr std::uint32_t event_mask(path_monitor_event::type t)
+{
+	return 1u << static_cast<std::uint32_t>(t);
+}
+
+template <typename T>
+void put(std::string &out, T value)
+{
+	out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void put(std::string &out, const std::string &value)
+{
+	put<std::uint16_t>(out, value.size());
+	out.append(value);
+}
+
+/// Start a frame; the length is filled in by end_frame().
+inline std::size_t begin_frame(std::string &out, message m)
+{
+	std::size_t start = out.size();
+
+	put<std::uint32_t>(out, 0);
+	put(out, m);
+
+	return start;
+}
+
+inline void end_frame(std::string &out, std::size_t start)
+{
+	std::uint32_t length = out.size() - start - sizeof(std::uint32_t);
+
+	std::memcpy(&out[start], &length, sizeof(length));
+}
+
+/// Cursor over a received frame payload.
+class frame
+{
+public:
+	frame(const char *data, std::size_t size)
+		: m_data(data),
+		m_size(size)
+	{
+	}
+
+	template <typename T>
+	bool get(T &value)
+	{
+		if (m_size - m_offset < sizeof(value))
+			return false;
+
+		std::memcpy(&value, m_data + m_offset, sizeof(value));
+		m_offset += sizeof(value);
+
+		return true;
+	}
+
+	bool get(std::string &value)
+	{
+		std::uint16_t length;
+
+		if (!get(length) or m_size - m_offset < length)
+			return false;
+
+		value.assign(m_data + m_offset, length);
+		m_offset += length;
+
+		return true;
+	}
+
+private:
+	const char *m_data;
+	std::size_t m_size;
+	std::size_t m_offset = 0;
+};
+
+/// Accumulates received bytes and splits them into frames.
+class frame_reader
+{
+public:
+	void append(const char *data, std::size_t size)
+	{
+		m_buffer.append(data, size);
+	}
+
+	/// Call function(frame) for every complete frame received so far.
+	/// Returns false once a frame announces more than max_frame_size,
+	/// after which the stream cannot be trusted.
+	template <typename Function>
+	bool consume(Function function)
+	{
+		std::size_t offset = 0;
+
+		while (m_buffer.size() - offset >= sizeof(std::uint32_t)) {
+			std::uint32_t length;
+
+			std::memcpy(&length, m_buffer.data() + offset, sizeof(length));
+
+			if (length > max_frame_size) {
+				m_buffer.clear();
+
+				return false;
+			}
+
+			if (m_buffer.size() - offset - sizeof(length) < length)
+				break;
+
+			function(frame(m_buffer.data() + offset + sizeof(length), length));
+
+			offset += sizeof(length) + length;
+		}
+
+		m_buffer.erase(0, offset);
+
+		return true;
+	}
+
+private:
+	std::string m_buffer;
+};
+
+} // namespace path_monitor_protocol
+
+/// Options for path_monitor_daemon.
+struct path_monitor_daemon_options
+{
+	/// Bytes of encoded events buffered per client before its events are
+	/// dropped and it is sent an overflow message.
+	std::size_t client_buffer_size = 1024 * 1024;
+
+	/// Size of the chunks client buffers are made of. A flush writes all
+	/// chunks of a client with a single vectored write.
+	std::size_t chunk_size = 64 * 1024;
+};
+
+/// Local daemon sharing one path monitor between many client processes over
+/// a Unix domain socket. Watches are reference counted across subscriptions
+/// so a directory is watched once however many clients subscribe to it.
+///
+/// All work happens in handlers of the io_context, which must be run by a
+/// single thread.
+class path_monitor_daemon
+{
+	class state;
+
+public:
+	path_monitor_daemon(boost::asio::io_context &io_context, const std::filesystem::path &socket_path,
+			    path_monitor_daemon_options options = path_monitor_daemon_options())
+		: m_state(std::make_shared<state>(io_context, socket_path, options))
+	{
+		m_state->start();
+	}
+
+	path_monitor_daemon(const path_monitor_daemon &) = delete;
+	path_monitor_daemon& operator=(const path_monitor_daemon &) = delete;
+
+	~path_monitor_daemon()
+	{
+		stop();
+	}
+
+	/// Close the listening socket and all client connections.
+	void stop()
+	{
+		if (m_state)
+			m_state->stop();
+
+		m_state.reset();
+	}
+
+private:
+	typedef boost::asio::local::stream_protocol protocol;
+
+	class client;
+
+	struct subscription
+	{
+		std::weak_ptr<client> owner;
+		std::uint32_t id;
+		std::uint32_t mask;
+		std::string filter;
+	};
+
+	class client
+		: public std::enable_shared_from_this<client>
+	{
+	public:
+		client(std::shared_ptr<state> daemon, protocol::socket socket)
+			: m_daemon(daemon),
+			m_socket(std::move(socket))
+		{
+		}
+
+		void start()
+		{
+			begin_read();
+		}
+
+		void close()
+		{
+			boost::system::error_code ec;
+
+			m_socket.close(ec);
+		}
+
+		/// Queue an encoded frame. Returns false if the client is too far
+		/// behind, in which case the frame is dropped.
+		bool enqueue(const std::string &frame, const path_monitor_daemon_options &options)
+		{
+			if (m_queued_bytes + frame.size() > options.client_buffer_size) {
+				m_overflowed = true;
+
+				return false;
+			}
+
+			if (m_overflowed) {
+				std::string notice;
+
+				path_monitor_protocol::end_frame(notice, path_monitor_protocol::begin_frame(notice, path_monitor_protocol::message::overflow));
+				append(notice, options);
+				m_overflowed = false;
+			}
+
+			append(frame, options);
+
+			return true;
+		}
+
+		/// Write all queued chunks with one vectored write unless a write is
+		/// already in progress.
+		void flush()
+		{
+			if (m_in_flight or m_queued.empty())
+				return;
+
+			std::vector<boost::asio::const_buffer> buffers;
+
+			for (const auto &chunk : m_queued)
+				buffers.push_back(boost::asio::buffer(chunk));
+
+			m_in_flight = m_queued.size();
+
+			boost::asio::async_write(m_socket, buffers,
+				[self = this->shared_from_this()](const boost::system::error_code &ec, std::size_t bytes) {
+					if (ec) {
+						self->disconnect();
+
+						return;
+					}
+
+					self->m_queued.erase(self->m_queued.begin(), self->m_queued.begin() + self->m_in_flight);
+					self->m_queued_bytes -= bytes;
+					self->m_in_flight = 0;
+					self->flush();
+				});
+		}
+
+		std::vector<std::uint32_t> &subscriptions()
+		{
+			return m_subscriptions;
+		}
+
+	private:
+		void append(const std::string &frame, const path_monitor_daemon_options &options)
+		{
+			// Chunks being written must not be modified.
+			if (m_queued.size() <= m_in_flight or m_queued.back().size() + frame.size() > options.chunk_size)
+				m_queued.emplace_back();
+
+			m_queued.back() += frame;
+			m_queued_bytes += frame.size();
+		}
+
+		void begin_read()
+		{
+			m_socket.async_read_some(boost::asio::buffer(m_read_buffer),
+				[self = this->shared_from_this()](const boost::system::error_code &ec, std::size_t bytes) {
+					if (ec) {
+						self->disconnect();
+
+						return;
+					}
+
+					self->m_reader.append(self->m_read_buffer.data(), bytes);
+
+					// Drop a client announcing an oversized frame rather
+					// than buffering it.
+					if (!self->m_reader.consume([&self](path_monitor_protocol::frame f) { self->dispatch(f); })) {
+						self->disconnect();
+
+						return;
+					}
+
+					self->begin_read();
+				});
+		}
+
+		void dispatch(path_monitor_protocol::frame f)
+		{
+			auto daemon = m_daemon.lock();
+
+			if (!daemon)
+				return;
+
+			path_monitor_protocol::message m;
+			std::uint32_t id = 0;
+
+			if (!f.get(m) or !f.get(id))
+				return;
+
+			if (m == path_monitor_protocol::message::subscribe) {
+				subscription s{ this->shared_from_this(), id, 0, std::string() };
+				std::string path;
+
+				if (f.get(s.mask) and f.get(path) and f.get(s.filter))
+					daemon->subscribe(this->shared_from_this(), path, s);
+			} else if (m == path_monitor_protocol::message::unsubscribe) {
+				daemon->unsubscribe(this->shared_from_this(), id);
+			}
+		}
+
+		void disconnect()
+		{
+			close();
+
+			if (auto daemon = m_daemon.lock())
+				daemon->disconnect(this->shared_from_this());
+		}
+
+		std::weak_ptr<state> m_daemon;
+		protocol::socket m_socket;
+		std::array<char, 4096> m_read_buffer;
+		path_monitor_protocol::frame_reader m_reader;
+		std::deque<std::string> m_queued;
+		std::size_t m_queued_bytes = 0;
+		std::size_t m_in_flight = 0;
+		bool m_overflowed = false;
+		std::vector<std::uint32_t> m_subscriptions;
+	};
+
+	class state
+		: public std::enable_shared_from_this<state>
+	{
+	public:
+		state(boost::asio::io_context &io_context, const std::filesystem::path &socket_path,
+		      path_monitor_daemon_options options)
+			: m_io_context(io_context),
+			m_socket_path(socket_path),
+			m_options(options),
+			m_acceptor(io_context),
+			m_monitor(io_context, "Path Monitor Daemon")
+		{
+			::unlink(m_socket_path.c_str());
+
+			protocol::endpoint endpoint(m_socket_path.string());
+
+			m_acceptor.open(endpoint.protocol());
+			m_acceptor.bind(endpoint);
+			m_acceptor.listen();
+		}
+
+		void start()
+		{
+			begin_accept();
+			begin_monitor();
+		}
+
+		void stop()
+		{
+			boost::system::error_code ec;
+
+			m_acceptor.close(ec);
+
+			for (auto &c : m_clients)
+				c->close();
+
+			m_clients.clear();
+			m_watches.clear();
+			m_monitor.stop();
+
+			::unlink(m_socket_path.c_str());
+		}
+
+		void subscribe(std::shared_ptr<client> c, const std::string &path, subscription s)
+		{
+			auto key = std::filesystem::path(path).lexically_normal().string();
+			int error = 0;
+
+			// An identifier stays with its first subscription until that
+			// one is cancelled.
+			if (m_subscription_paths.count(std::make_pair(c.get(), s.id))) {
+				error = EEXIST;
+			} else if (!m_watches.count(key)) {
+				std::system_error se;
+
+				m_monitor.add_path(key, se);
+				error = se.code().value();
+			}
+
+			if (!error) {
+				m_watches[key].push_back(s);
+				c->subscriptions().push_back(s.id);
+				m_subscription_paths[std::make_pair(c.get(), s.id)] = key;
+			}
+
+			std::string reply;
+			auto start = path_monitor_protocol::begin_frame(reply, path_monitor_protocol::message::subscribed);
+
+			path_monitor_protocol::put(reply, s.id);
+			path_monitor_protocol::put<std::int32_t>(reply, error);
+			path_monitor_protocol::end_frame(reply, start);
+
+			c->enqueue(reply, m_options);
+			c->flush();
+		}
+
+		void unsubscribe(std::shared_ptr<client> c, std::uint32_t id)
+		{
+			auto it = m_subscription_paths.find(std::make_pair(c.get(), id));
+
+			if (it == m_subscription_paths.end())
+				return;
+
+			auto watch = m_watches.find(it->second);
+
+			if (watch != m_watches.end()) {
+				auto &subscriptions = watch->second;
+
+				subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(), [&](const subscription &s) {
+					return s.id == id and s.owner.lock() == c;
+				}), subscriptions.end());
+
+				// The last subscriber of a directory releases its watch.
+				if (subscriptions.empty()) {
+					std::system_error se;
+
+					m_monitor.remove_path(watch->first, se);
+					m_watches.erase(watch);
+				}
+			}
+
+			m_subscription_paths.erase(it);
+
+			auto &ids = c->subscriptions();
+
+			ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+		}
+
+		void disconnect(std::shared_ptr<client> c)
+		{
+			auto ids = c->subscriptions();
+
+			for (auto id : ids)
+				unsubscribe(c, id);
+
+			m_clients.erase(c);
+		}
+
+	private:
+		void begin_accept()
+		{
+			m_acceptor.async_accept([weak = weak_from_this()](const boost::system::error_code &ec, protocol::socket socket) {
+				auto self = weak.lock();
+
+				if (!self or ec == boost::asio::error::operation_aborted)
+					return;
+
+				if (!ec) {
+					auto c = std::make_shared<client>(self, std::move(socket));
+
+					self->m_clients.insert(c);
+					c->start();
+				}
+
+				self->begin_accept();
+			});
+		}
+
+		void begin_monitor()
+		{
+			// The monitor completes on its service's thread; dispatch on
+			// the daemon's so the clients and watches have a single user.
+			m_monitor.async_monitor([weak = weak_from_this()](const std::system_error &se, const path_monitor_event &ev) {
+				auto self = weak.lock();
+
+				if (!self or se.code())
+					return;
+
+				boost::asio::post(self->m_io_context, [weak, ev] {
+					auto self = weak.lock();
+
+					if (!self)
+						return;
+
+					self->dispatch(ev);
+					self->begin_monitor();
+				});
+			});
+		}
+
+		/// Encode an event once per subscription and flush every client
+		/// that received something.
+		void dispatch(const path_monitor_event &ev)
+		{
+			auto watch = m_watches.find(ev.parent_path.string());
+
+			if (watch == m_watches.end())
+				return;
+
+			const auto name = ev.path.string();
+			std::set<std::shared_ptr<client>> touched;
+			std::string frame;
+
+			for (const auto &s : watch->second) {
+				if (!(s.mask & path_monitor_protocol::event_mask(ev.event)))
+					continue;
+
+				if (!s.filter.empty() and ::fnmatch(s.filter.c_str(), name.c_str(), 0) != 0)
+					continue;
+
+				auto c = s.owner.lock();
+
+				if (!c)
+					continue;
+
+				frame.clear();
+
+				auto start = path_monitor_protocol::begin_frame(frame, path_monitor_protocol::message::event);
+
+				path_monitor_protocol::put(frame, s.id);
+				path_monitor_protocol::put(frame, static_cast<std::uint8_t>(ev.event));
+				path_monitor_protocol::put(frame, name);
+				path_monitor_protocol::end_frame(frame, start);
+
+				c->enqueue(frame, m_options);
+				touched.insert(c);
+			}
+
+			// Clients that are still writing pick up the new frames when
+			// their write completes, batching events for slow readers.
+			for (const auto &c : touched)
+				c->flush();
+		}
+
+		boost::asio::io_context &m_io_context;
+		std::filesystem::path m_socket_path;
+		path_monitor_daemon_options m_options;
+		protocol::acceptor m_acceptor;
+		path_monitor m_monitor;
+		std::set<std::shared_ptr<client>> m_clients;
+		std::map<std::string, std::vector<subscription>> m_watches;
+		std::map<std::pair<const client*, std::uint32_t>, std::string> m_subscription_paths;
+	};
+
+	std::shared_ptr<state> m_state;
+};
+
+/// Client of a path_monitor_daemon. The interface mirrors basic_path_monitor:
+/// subscribe() takes the place of add_path(), and monitor() and
+/// async_monitor() deliver events with the subscribed path as parent path.
+class path_monitor_client
+{
+public:
+	explicit path_monitor_client(boost::asio::io_context &io_context)
+		: m_socket(io_context)
+	{
+	}
+
+	/// Connect to the daemon listening on socket_path.
+	void connect(const std::filesystem::path &socket_path, std::system_error &se)
+	{
+		boost::system::error_code ec;
+
+		m_socket.connect(boost::asio::local::stream_protocol::endpoint(socket_path.string()), ec);
+
+		if (ec) {
+			se = std::system_error(path_monitor_protocol::to_error_code(ec),
+					       "service::path_monitor_client::connect: connecting to \"" + socket_path.string() + "\" failed");
+
+			return;
+		}
+
+		se = operation_succeeded();
+	}
+
+	/// Subscribe to events of a directory. mask selects event types, see
+	/// path_monitor_protocol::event_mask(), and filter is an optional
+	/// fnmatch() pattern matched against event names. Returns the
+	/// subscription identifier.
+	std::uint32_t subscribe(const std::filesystem::path &path, std::uint32_t mask, const std::string &filter,
+				std::system_error &se)
+	{
+		std::uint32_t id = ++m_last_id;
+		std::string request;
+		auto start = path_monitor_protocol::begin_frame(request, path_monitor_protocol::message::subscribe);
+
+		path_monitor_protocol::put(request, id);
+		path_monitor_protocol::put(request, mask);
+		path_monitor_protocol::put(request, path.string());
+		path_monitor_protocol::put(request, filter);
+		path_monitor_protocol::end_frame(request, start);
+
+		if (!send(request, se))
+			return 0;
+
+		m_paths[id] = path;
+
+		// Events of other subscriptions received meanwhile stay queued.
+		while (!m_replies.count(id)) {
+			if (!receive(se))
+				return 0;
+		}
+
+		int error = m_replies[id];
+
+		m_replies.erase(id);
+
+		if (error) {
+			m_paths.erase(id);
+			se = std::system_error(std::error_code(error, std::system_category()),
+					       "service::path_monitor_client::subscribe: subscribing to \"" + path.string() + "\" failed");
+
+			return 0;
+		}
+
+		se = operation_succeeded();
+
+		return id;
+	}
+
+	/// Cancel a subscription.
+	void unsubscribe(std::uint32_t id, std::system_error &se)
+	{
+		std::string request;
+		auto start = path_monitor_protocol::begin_frame(request, path_monitor_protocol::message::unsubscribe);
+
+		path_monitor_protocol::put(request, id);
+		path_monitor_protocol::end_frame(request, start);
+
+		if (send(request, se))
+			m_paths.erase(id);
+	}
+
+	/// Monitor path events synchronously. Completes with
+	/// std::errc::no_buffer_space when the daemon dropped events.
+	path_monitor_event monitor(std::system_error &se)
+	{
+		while (m_events.empty()) {
+			if (!receive(se))
+				return path_monitor_event();
+		}
+
+		return pop(se);
+	}
+
+	/// Monitor path events asynchronously.
+	template <typename Handler>
+	void async_monitor(Handler handler)
+	{
+		if (!m_events.empty()) {
+			std::system_error se;
+			auto ev = pop(se);
+
+			boost::asio::post(m_socket.get_executor(), [handler, se, ev]() mutable { handler(se, ev); });
+
+			return;
+		}
+
+		m_socket.async_read_some(boost::asio::buffer(m_read_buffer),
+			[this, handler](const boost::system::error_code &ec, std::size_t bytes) mutable {
+				if (ec) {
+					handler(std::system_error(path_monitor_protocol::to_error_code(ec),
+								  "service::path_monitor_client::async_monitor: read failed"),
+						path_monitor_event());
+
+					return;
+				}
+
+				if (!parse(bytes)) {
+					handler(oversized_frame("async_monitor"), path_monitor_event());
+
+					return;
+				}
+
+				async_monitor(handler);
+			});
+	}
+
+	/// Close the connection to the daemon.
+	void close()
+	{
+		boost::system::error_code ec;
+
+		m_socket.close(ec);
+	}
+
+private:
+	struct queued_event
+	{
+		path_monitor_event ev;
+		bool overflow = false;
+	};
+
+	bool send(const std::string &request, std::system_error &se)
+	{
+		boost::system::error_code ec;
+
+		boost::asio::write(m_socket, boost::asio::buffer(request), ec);
+
+		if (ec) {
+			se = std::system_error(path_monitor_protocol::to_error_code(ec),
+					       "service::path_monitor_client: write failed");
+
+			return false;
+		}
+
+		return true;
+	}
+
+	bool receive(std::system_error &se)
+	{
+		boost::system::error_code ec;
+		std::size_t bytes = m_socket.read_some(boost::asio::buffer(m_read_buffer), ec);
+
+		if (ec) {
+			se = std::system_error(path_monitor_protocol::to_error_code(ec),
+					       "service::path_monitor_client: read failed");
+
+			return false;
+		}
+
+		if (!parse(bytes)) {
+			se = oversized_frame("receive");
+
+			return false;
+		}
+
+		return true;
+	}
+
+	static std::system_error oversized_frame(const std::string &method)
+	{
+		return std::system_error(std::make_error_code(std::errc::protocol_error),
+					 "service::path_monitor_client::" + method + ": oversized frame");
+	}
+
+	/// Decode received bytes; false if the daemon sent an oversized frame.
+	bool parse(std::size_t bytes)
+	{
+		m_reader.append(m_read_buffer.data(), bytes);
+
+		return m_reader.consume([this](path_monitor_protocol::frame f) {
+			path_monitor_protocol::message m;
+			std::uint32_t id = 0;
+
+			if (!f.get(m))
+				return;
+
+			if (m == path_monitor_protocol::message::overflow) {
+				m_events.push_back(queued_event{ path_monitor_event(), true });
+			} else if (m == path_monitor_protocol::message::subscribed) {
+				std::int32_t error = 0;
+
+				if (f.get(id) and f.get(error))
+					m_replies[id] = error;
+			} else if (m == path_monitor_protocol::message::event) {
+				std::uint8_t type;
+				std::string name;
+
+				if (!f.get(id) or !f.get(type) or !f.get(name))
+					return;
+
+				auto it = m_paths.find(id);
+
+				if (it != m_paths.end())
+					m_events.push_back(queued_event{ path_monitor_event(it->second, name, static_cast<path_monitor_event::type>(type)) });
+			}
+		});
+	}
+
+	path_monitor_event pop(std::system_error &se)
+	{
+		auto q = std::move(m_events.front());
+
+		m_events.pop_front();
+
+		if (q.overflow) {
+			se = std::system_error(std::make_error_code(std::errc::no_buffer_space),
+					       "service::path_monitor_client::monitor: the daemon dropped events");
+		} else {
+			se = operation_succeeded();
+		}
+
+		return q.ev;
+	}
+
+	boost::asio::local::stream_protocol::socket m_socket;
+	std::array<char, 4096> m_read_buffer;
+	path_monitor_protocol::frame_reader m_reader;
+	std::deque<queued_event> m_events;
+	std::map<std::uint32_t, std::filesystem::path> m_paths;
+	std::map<std::uint32_t, int> m_replies;
+	std::uint32_t m_last_id = 0;
+};
+
+} // namespace services
+
+#endif // SERVICES_PATH_MONITOR_DAEMON_HPP
@@ -0,0 +1,95 @@
+//
+// path_monitor_policy.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_PATH_MONITOR_POLICY_HPP
+#define SERVICES_PATH_MONITOR_POLICY_HPP
+
+#include <condition_variable>
+#include <mutex>
+
+#include "event_queue.hpp"
+
+namespace services {
+
+/// Mutex that does nothing, for state only one thread touches.
+struct null_mutex
+{
+	void lock()
+	{
+	}
+
+	bool try_lock()
+	{
+		return true;
+	}
+
+	void unlock()
+	{
+	}
+};
+
+/// Condition variable that never waits, paired with null_mutex.
+struct null_condition
+{
+	template <typename Lock>
+	void wait(Lock &)
+	{
+	}
+
+	void notify_one()
+	{
+	}
+
+	void notify_all()
+	{
+	}
+};
+
+/// Threading policy of a monitor read by its own thread and used from any.
+struct multi_threaded
+{
+	static constexpr bool threaded = true;
+
+	typedef std::mutex mutex_type;
+	typedef std::condition_variable condition_type;
+};
+
+/// Threading policy of a monitor used synchronously from one thread. No
+/// reader thread is started; the kernel's queue is read on the caller's
+/// thread while it waits in monitor(), and the event queue is not locked.
+/// Such a monitor must not be used with async_monitor(), subscribe(),
+/// monitor sets, event sinks or the shared io_uring reader, which consume
+/// or produce events on other threads.
+struct single_threaded
+{
+	static constexpr bool threaded = false;
+
+	typedef null_mutex mutex_type;
+	typedef null_condition condition_type;
+};
+
+/// Compile-time configuration of a path monitor backend. Queue is the event
+/// queue, priority_event_queue or fifo_event_queue.
+template <typename Threading = multi_threaded, typename Queue = priority_event_queue>
+struct path_monitor_policy
+{
+	typedef Threading threading;
+	typedef Queue queue_type;
+};
+
+/// Configuration of services::path_monitor.
+typedef path_monitor_policy<> default_path_monitor_policy;
+
+/// Configuration for one thread reading one monitor in arrival order.
+typedef path_monitor_policy<single_threaded, fifo_event_queue> minimal_path_monitor_policy;
+
+} // namespace services
+
+#endif // SERVICES_PATH_MONITOR_POLICY_HPP
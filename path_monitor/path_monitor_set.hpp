@@ -0,0 +1,244 @@
+//
+// path_monitor_set.hpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_PATH_MONITOR_SET_HPP
+#define SERVICES_PATH_MONITOR_SET_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+#include "path_monitor.hpp"
+
+namespace services {
+
+/// Waits on many monitors from one thread. Monitors are registered with
+/// their backend's notify_when_ready() and queued once when they get
+/// events; wait() serves the queued monitors round-robin, at most quantum
+/// events each per turn, so a busy monitor cannot starve quiet ones. A
+/// monitor in a set must not also have a subscription. wait() is called
+/// from one thread at a time.
+template <typename Monitor>
+class basic_path_monitor_set
+{
+public:
+	/// An event and the monitor it came from.
+	struct entry
+	{
+		Monitor *monitor;
+		path_monitor_event event;
+	};
+
+	explicit basic_path_monitor_set(std::size_t quantum = 16)
+		: m_core(std::make_shared<core>()),
+		m_quantum(quantum ? quantum : 1)
+	{
+	}
+
+	basic_path_monitor_set(const basic_path_monitor_set &) = delete;
+	basic_path_monitor_set& operator=(const basic_path_monitor_set &) = delete;
+
+	~basic_path_monitor_set()
+	{
+		std::unique_lock<std::mutex> lk(m_core->mutex);
+
+		for (auto &s : m_slots)
+			s->removed = true;
+	}
+
+	/// Add a monitor, which must stay alive until it is removed or stops.
+	void add(Monitor &monitor)
+	{
+		auto s = std::make_shared<slot>();
+
+		s->monitor = &monitor;
+		s->impl = monitor.get_implementation();
+		s->owner = m_core;
+
+		{
+			std::unique_lock<std::mutex> lk(m_core->mutex);
+
+			m_slots.push_back(s);
+		}
+
+		arm(s);
+	}
+
+	/// Remove a monitor. Its queued events stay with it.
+	void remove(Monitor &monitor)
+	{
+		std::unique_lock<std::mutex> lk(m_core->mutex);
+
+		for (auto it = m_slots.begin(); it != m_slots.end(); ++it) {
+			if ((*it)->monitor == &monitor) {
+				drop(*it);
+
+				break;
+			}
+		}
+	}
+
+	/// Number of monitors in the set. A stopped monitor leaves the set on
+	/// the next wait().
+	std::size_t size()
+	{
+		std::unique_lock<std::mutex> lk(m_core->mutex);
+
+		return m_slots.size();
+	}
+
+	/// Append up to max events of ready monitors to events, waiting up to
+	/// timeout for one to become ready; duration::max() waits without limit
+	/// and zero does not wait. Returns the number appended and fails with
+	/// std::errc::timed_out if none was.
+	std::size_t wait(std::vector<entry> &events, std::size_t max,
+			 std::chrono::steady_clock::duration timeout, std::system_error &se)
+	{
+		auto deadline = std::chrono::steady_clock::now();
+
+		if (timeout == std::chrono::steady_clock::duration::max())
+			deadline = std::chrono::steady_clock::time_point::max();
+		else
+			deadline += timeout;
+
+		std::size_t count = 0;
+		std::unique_lock<std::mutex> lk(m_core->mutex);
+
+		// A ready monitor may yield nothing, if it stopped or another
+		// caller took its events, so wait again until one does.
+		while (!count) {
+			while (m_core->ready.empty()) {
+				if (m_core->cond.wait_until(lk, deadline) == std::cv_status::timeout and m_core->ready.empty()) {
+					se = std::system_error(std::make_error_code(std::errc::timed_out),
+							       "service::basic_path_monitor_set::wait: timed out");
+
+					return 0;
+				}
+			}
+
+			while (count < max and !m_core->ready.empty()) {
+				auto s = std::move(m_core->ready.front());
+
+				m_core->ready.pop_front();
+				lk.unlock();
+
+				std::system_error e = operation_succeeded();
+				auto impl = s->impl.lock();
+
+				m_batch.clear();
+
+				if (impl)
+					impl->popfront_events(m_batch, std::min(m_quantum, max - count), e);
+
+				for (auto &ev : m_batch)
+					events.push_back(entry{ s->monitor, std::move(ev) });
+
+				count += m_batch.size();
+
+				// Serve the monitor again after the others if it has more.
+				bool stopped = !impl or e.code();
+				bool again = !stopped and !impl->notify_when_ready(callback(s));
+
+				lk.lock();
+
+				if (stopped)
+					drop(s);
+				else if (again and !s->removed)
+					m_core->ready.push_back(s);
+			}
+
+			if (!max)
+				break;
+		}
+
+		se = count ? operation_succeeded() : std::system_error(std::make_error_code(std::errc::timed_out),
+			"service::basic_path_monitor_set::wait: timed out");
+
+		return count;
+	}
+
+private:
+	struct slot;
+
+	/// State shared with the callbacks, which may outlive the set.
+	struct core
+	{
+		std::mutex mutex;
+		std::condition_variable cond;
+		std::deque<std::shared_ptr<slot>> ready;
+	};
+
+	struct slot
+	{
+		Monitor *monitor = nullptr;
+		std::weak_ptr<typename Monitor::impl_type::element_type> impl;
+		std::weak_ptr<core> owner;
+		bool removed = false;
+	};
+
+	static std::function<void()> callback(const std::shared_ptr<slot> &s)
+	{
+		return [s]() {
+			auto c = s->owner.lock();
+
+			if (!c)
+				return;
+
+			std::unique_lock<std::mutex> lk(c->mutex);
+
+			if (!s->removed) {
+				c->ready.push_back(s);
+				c->cond.notify_one();
+			}
+		};
+	}
+
+	void arm(const std::shared_ptr<slot> &s)
+	{
+		auto impl = s->impl.lock();
+
+		if (impl and impl->notify_when_ready(callback(s)))
+			return;
+
+		std::unique_lock<std::mutex> lk(m_core->mutex);
+
+		if (!s->removed) {
+			m_core->ready.push_back(s);
+			m_core->cond.notify_one();
+		}
+	}
+
+	/// Forget a monitor; called with the core locked.
+	void drop(const std::shared_ptr<slot> &s)
+	{
+		s->removed = true;
+		m_slots.erase(std::remove(m_slots.begin(), m_slots.end(), s), m_slots.end());
+		m_core->ready.erase(std::remove(m_core->ready.begin(), m_core->ready.end(), s), m_core->ready.end());
+	}
+
+	std::shared_ptr<core> m_core;
+	std::size_t m_quantum;
+	std::vector<std::shared_ptr<slot>> m_slots;
+	std::vector<path_monitor_event> m_batch;
+};
+
+/// Set of inotify path monitors.
+typedef basic_path_monitor_set<path_monitor> path_monitor_set;
+
+} // namespace services
+
+#endif // SERVICES_PATH_MONITOR_SET_HPP
@@ -0,0 +1,528 @@
+//
+// shared_event_ring.hpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_SHARED_EVENT_RING_HPP
+#define SERVICES_SHARED_EVENT_RING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#define BOOST_ERROR_CODE_HEADER_ONLY
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "basic_path_monitor.hpp"
+
+namespace services {
+
+/// Shared memory layout of an event ring. A single publisher writes fixed
+/// size slots in sequence order and readers in any number of processes follow
+/// at their own pace. A slot is stable while its sequence field matches the
+/// sequence a reader expects; a publisher lapping a reader overwrites it.
+namespace shared_event_ring_format {
+
+constexpr char magic[8] = { 'P', 'M', 'R', 'I', 'N', 'G', '0', '1' };
+constexpr std::uint32_t version = 2;
+constexpr std::uint32_t truncated = 1;
+
+struct header
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t slot_size;
+	std::uint64_t slot_count;
+	std::int32_t publisher_pid;	// Tells a stale segment from a live one.
+	alignas(64) std::atomic<std::uint64_t> write_sequence;
+	alignas(64) std::atomic<std::uint32_t> futex;
+	std::atomic<std::uint32_t> waiters;
+};
+
+struct slot
+{
+	std::atomic<std::uint64_t> sequence;	// Sequence + 1 of the stored event, zero while written.
+	std::uint16_t type;
+	std::uint16_t flags;
+	std::uint16_t parent_length;
+	std::uint16_t path_length;
+	char names[1];
+};
+
+constexpr std::size_t names_offset = offsetof(slot, names);
+
+inline long futex(std::atomic<std::uint32_t> *word, int op, std::uint32_t value, const timespec *timeout = nullptr)
+{
+	return ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(word), op, value, timeout, nullptr, 0);
+}
+
+} // namespace shared_event_ring_format
+
+/// Event stored in a shared event ring. The views point into shared memory
+/// and are only meaningful while shared_event_ring_reader::valid() holds.
+struct shared_event_view
+{
+	std::uint64_t sequence = 0;
+	path_monitor_event::type event = path_monitor_event::type::null;
+	std::string_view parent_path;
+	std::string_view path;
+	bool truncated = false;		// Names did not fit in a slot.
+
+	/// Copy the event out of shared memory.
+	path_monitor_event to_event() const
+	{
+		return path_monitor_event(std::string(parent_path), std::string(path), event);
+	}
+};
+
+/// Options for creating a shared event ring.
+struct shared_event_ring_options
+{
+	/// Bytes per slot including the slot header; bounds the name length.
+	std::uint32_t slot_size = 512;
+
+	/// Number of slots; rounded up to a power of two.
+	std::uint64_t slot_count = 8192;
+};
+
+/// Event sink publishing every event of a monitor into a named POSIX shared
+/// memory ring. The segment is unlinked when the publisher is destroyed.
+/// Creating a publisher fails with std::errc::file_exists while another
+/// live publisher owns the name; the segment left by a publisher that died
+/// is replaced.
+class shared_event_ring_publisher
+	: public path_monitor_event_sink
+{
+public:
+	shared_event_ring_publisher(const std::string &name, shared_event_ring_options options = shared_event_ring_options())
+		: m_name(name)
+	{
+		std::uint64_t slot_count = 1;
+
+		while (slot_count < options.slot_count)
+			slot_count <<= 1;
+
+		m_slot_size = (std::max<std::uint32_t>(options.slot_size, 64) + 63) & ~63u;
+		m_mask = slot_count - 1;
+		m_size = sizeof(shared_event_ring_format::header) + slot_count * m_slot_size;
+
+		// Never truncate a ring that readers may still have mapped.
+		int fd = ::shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+		int error = errno;
+
+		if (fd == -1 and error == EEXIST and stale(m_name) and ::shm_unlink(m_name.c_str()) == 0) {
+			fd = ::shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+			error = errno;
+		}
+
+		if (fd == -1) {
+			throw std::system_error(std::error_code(error, std::system_category()),
+						"service::shared_event_ring_publisher: shm_open for \"" + m_name + "\" failed");
+		}
+
+		if (::ftruncate(fd, m_size) == -1) {
+			error = errno;
+
+			::close(fd);
+			::shm_unlink(m_name.c_str());
+
+			throw std::system_error(std::error_code(error, std::system_category()),
+						"service::shared_event_ring_publisher: ftruncate for \"" + m_name + "\" failed");
+		}
+
+		void *data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		error = errno;
+
+		::close(fd);
+
+		if (data == MAP_FAILED) {
+			::shm_unlink(m_name.c_str());
+
+			throw std::system_error(std::error_code(error, std::system_category()),
+						"service::shared_event_ring_publisher: mmap for \"" + m_name + "\" failed");
+		}
+
+		m_data = static_cast<char*>(data);
+
+		// The segment is zero filled; the magic is written last so that
+		// readers never attach to a half initialised ring.
+		auto *h = header();
+
+		h->version = shared_event_ring_format::version;
+		h->slot_size = m_slot_size;
+		h->slot_count = slot_count;
+		h->publisher_pid = ::getpid();
+
+		std::atomic_thread_fence(std::memory_order_release);
+		std::memcpy(h->magic, shared_event_ring_format::magic, sizeof(h->magic));
+	}
+
+	shared_event_ring_publisher(const shared_event_ring_publisher &) = delete;
+	shared_event_ring_publisher& operator=(const shared_event_ring_publisher &) = delete;
+
+	~shared_event_ring_publisher()
+	{
+		::munmap(m_data, m_size);
+		::shm_unlink(m_name.c_str());
+	}
+
+	void consume(const path_monitor_event &ev) override
+	{
+		publish(ev.event, ev.parent_path.native(), ev.path.native());
+	}
+
+	/// Publish an event. Only one thread may publish at a time; the monitor's
+	/// reader thread is the only caller when used as a sink.
+	void publish(path_monitor_event::type type, std::string_view parent_path, std::string_view path)
+	{
+		auto *h = header();
+		auto sequence = h->write_sequence.load(std::memory_order_relaxed);
+		auto *s = slot(sequence);
+		std::size_t capacity = m_slot_size - shared_event_ring_format::names_offset;
+		std::uint16_t flags = 0;
+
+		if (parent_path.size() + path.size() > capacity) {
+			flags |= shared_event_ring_format::truncated;
+			parent_path = parent_path.substr(0, std::min(parent_path.size(), capacity));
+			path = path.substr(0, capacity - parent_path.size());
+		}
+
+		s->sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		s->type = static_cast<std::uint16_t>(type);
+		s->flags = flags;
+		s->parent_length = parent_path.size();
+		s->path_length = path.size();
+
+		std::memcpy(s->names, parent_path.data(), parent_path.size());
+		std::memcpy(s->names + parent_path.size(), path.data(), path.size());
+
+		s->sequence.store(sequence + 1, std::memory_order_release);
+		h->write_sequence.store(sequence + 1, std::memory_order_release);
+
+		h->futex.fetch_add(1);
+
+		if (h->waiters.load())
+			shared_event_ring_format::futex(&h->futex, FUTEX_WAKE, INT32_MAX);
+	}
+
+	const std::string &name() const
+	{
+		return m_name;
+	}
+
+private:
+	/// Return true if the ring named name was left by a publisher that is
+	/// gone. A ring still being initialised or of another format is not.
+	static bool stale(const std::string &name)
+	{
+		int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+
+		if (fd == -1)
+			return false;
+
+		struct stat st;
+		void *data = MAP_FAILED;
+
+		if (::fstat(fd, &st) == 0 and std::size_t(st.st_size) >= sizeof(shared_event_ring_format::header))
+			data = ::mmap(nullptr, sizeof(shared_event_ring_format::header), PROT_READ, MAP_SHARED, fd, 0);
+
+		::close(fd);
+
+		if (data == MAP_FAILED)
+			return false;
+
+		const auto *h = static_cast<const shared_event_ring_format::header*>(data);
+		bool stale = false;
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (!std::memcmp(h->magic, shared_event_ring_format::magic, sizeof(h->magic)) and
+		    h->version == shared_event_ring_format::version)
+			stale = ::kill(h->publisher_pid, 0) == -1 and errno == ESRCH;
+
+		::munmap(data, sizeof(shared_event_ring_format::header));
+
+		return stale;
+	}
+
+	shared_event_ring_format::header *header() const
+	{
+		return reinterpret_cast<shared_event_ring_format::header*>(m_data);
+	}
+
+	shared_event_ring_format::slot *slot(std::uint64_t sequence) const
+	{
+		return reinterpret_cast<shared_event_ring_format::slot*>(
+			m_data + sizeof(shared_event_ring_format::header) + (sequence & m_mask) * m_slot_size);
+	}
+
+	std::string m_name;
+	char *m_data = nullptr;
+	std::size_t m_size = 0;
+	std::uint32_t m_slot_size = 0;
+	std::uint64_t m_mask = 0;
+};
+
+/// Reader attached to a shared event ring published by another process. The
+/// interface mirrors basic_path_monitor: monitor() blocks for the next event
+/// and async_monitor() delivers it to a handler through the io_context.
+///
+/// A reader that falls a full ring behind skips to the oldest event still
+/// available and reports std::errc::no_buffer_space once.
+class shared_event_ring_reader
+{
+public:
+	shared_event_ring_reader(boost::asio::io_context &io_context, const std::string &name)
+		: m_io_context(io_context),
+		m_work_io_context(),
+		m_work(boost::asio::make_work_guard(m_work_io_context))
+	{
+		int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+
+		if (fd == -1) {
+			throw std::system_error(std::error_code(errno, std::system_category()),
+						"service::shared_event_ring_reader: shm_open for \"" + name + "\" failed");
+		}
+
+		struct stat st;
+
+		if (::fstat(fd, &st) == -1 or std::size_t(st.st_size) < sizeof(shared_event_ring_format::header)) {
+			::close(fd);
+
+			throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+						"service::shared_event_ring_reader: \"" + name + "\" is not an event ring");
+		}
+
+		m_size = st.st_size;
+
+		// Mapped writable only to register as a futex waiter.
+		void *data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		int error = errno;
+
+		::close(fd);
+
+		if (data == MAP_FAILED) {
+			throw std::system_error(std::error_code(error, std::system_category()),
+						"service::shared_event_ring_reader: mmap for \"" + name + "\" failed");
+		}
+
+		m_data = static_cast<char*>(data);
+
+		auto *h = header();
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (std::memcmp(h->magic, shared_event_ring_format::magic, sizeof(h->magic)) or
+		    h->version != shared_event_ring_format::version or
+		    !h->slot_count or (h->slot_count & (h->slot_count - 1)) or
+		    h->slot_size <= shared_event_ring_format::names_offset or
+		    sizeof(*h) + h->slot_count * h->slot_size > m_size) {
+			::munmap(m_data, m_size);
+
+			throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+						"service::shared_event_ring_reader: \"" + name + "\" is not an event ring");
+		}
+
+		// Start with events published from now on.
+		m_next_sequence = h->write_sequence.load(std::memory_order_acquire);
+
+		m_work_thread = std::thread(std::bind(static_cast<std::size_t (boost::asio::io_context::*)()>(
+			&boost::asio::io_context::run), &m_work_io_context));
+	}
+
+	shared_event_ring_reader(const shared_event_ring_reader &) = delete;
+	shared_event_ring_reader& operator=(const shared_event_ring_reader &) = delete;
+
+	~shared_event_ring_reader()
+	{
+		stop();
+
+		m_work.reset();
+		m_work_io_context.stop();
+
+		if (m_work_thread.joinable())
+			m_work_thread.join();
+
+		::munmap(m_data, m_size);
+	}
+
+	/// Interrupt blocked monitor() calls; they complete with
+	/// std::errc::operation_canceled.
+	void stop()
+	{
+		m_run = false;
+
+		shared_event_ring_format::futex(&header()->futex, FUTEX_WAKE, INT32_MAX);
+	}
+
+	/// Return the next event without blocking. Returns false if there is
+	/// none or the reader was lapped, in which case se is set.
+	bool try_monitor(shared_event_view &view, std::system_error &se)
+	{
+		auto *h = header();
+		auto write_sequence = h->write_sequence.load(std::memory_order_acquire);
+
+		se = operation_succeeded();
+
+		if (m_next_sequence >= write_sequence)
+			return false;
+
+		if (write_sequence - m_next_sequence > h->slot_count) {
+			lapped(se);
+
+			return false;
+		}
+
+		const auto *s = slot(m_next_sequence);
+
+		if (s->sequence.load(std::memory_order_acquire) != m_next_sequence + 1) {
+			lapped(se);
+
+			return false;
+		}
+
+		view.sequence = m_next_sequence;
+		view.event = static_cast<path_monitor_event::type>(s->type);
+		view.truncated = s->flags & shared_event_ring_format::truncated;
+		view.parent_path = std::string_view(s->names, std::min<std::size_t>(s->parent_length, capacity()));
+		view.path = std::string_view(s->names + view.parent_path.size(),
+					     std::min<std::size_t>(s->path_length, capacity() - view.parent_path.size()));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// The publisher may have started overwriting the slot while the
+		// header fields were read.
+		if (s->sequence.load(std::memory_order_relaxed) != m_next_sequence + 1) {
+			lapped(se);
+
+			return false;
+		}
+
+		++m_next_sequence;
+
+		return true;
+	}
+
+	/// Wait for the next event.
+	shared_event_view monitor(std::system_error &se)
+	{
+		auto *h = header();
+		shared_event_view view;
+
+		while (m_run) {
+			auto futex = h->futex.load(std::memory_order_acquire);
+
+			if (try_monitor(view, se) or se.code())
+				return view;
+
+			h->waiters.fetch_add(1);
+
+			// Bounded so that a publisher that went away cannot block forever.
+			timespec timeout = { 0, 100 * 1000 * 1000 };
+
+			if (m_run and h->write_sequence.load(std::memory_order_acquire) == m_next_sequence)
+				shared_event_ring_format::futex(&h->futex, FUTEX_WAIT, futex, &timeout);
+
+			h->waiters.fetch_sub(1);
+		}
+
+		se = std::system_error(std::error_code(static_cast<int>(std::errc::operation_canceled), std::system_category()),
+				       "service::shared_event_ring_reader::monitor: operation canceled");
+
+		return shared_event_view();
+	}
+
+	/// Deliver the next event to handler(const std::system_error &, const
+	/// shared_event_view &) through the io_context.
+	template <typename Handler>
+	void async_monitor(Handler handler)
+	{
+		boost::asio::post(m_work_io_context, [this, work = boost::asio::make_work_guard(m_io_context), handler]() mutable {
+			std::system_error se;
+
+			auto view = monitor(se);
+
+			boost::asio::post(m_io_context, [handler, se, view]() mutable { handler(se, view); });
+		});
+	}
+
+	/// Check that the names of an event have not been overwritten since it
+	/// was read.
+	bool valid(const shared_event_view &view) const
+	{
+		return slot(view.sequence)->sequence.load(std::memory_order_acquire) == view.sequence + 1;
+	}
+
+	/// Get the io_context associated with the object.
+	boost::asio::io_context &get_io_context()
+	{
+		return m_io_context;
+	}
+
+private:
+	shared_event_ring_format::header *header() const
+	{
+		return reinterpret_cast<shared_event_ring_format::header*>(m_data);
+	}
+
+	const shared_event_ring_format::slot *slot(std::uint64_t sequence) const
+	{
+		return reinterpret_cast<const shared_event_ring_format::slot*>(
+			m_data + sizeof(shared_event_ring_format::header) + (sequence & (header()->slot_count - 1)) * header()->slot_size);
+	}
+
+	std::size_t capacity() const
+	{
+		return header()->slot_size - shared_event_ring_format::names_offset;
+	}
+
+	void lapped(std::system_error &se)
+	{
+		auto write_sequence = header()->write_sequence.load(std::memory_order_acquire);
+
+		if (write_sequence - m_next_sequence >= header()->slot_count)
+			m_next_sequence = write_sequence - header()->slot_count + 1;
+
+		se = std::system_error(std::make_error_code(std::errc::no_buffer_space),
+				       "service::shared_event_ring_reader: events were overwritten before they were read");
+	}
+
+	boost::asio::io_context &m_io_context;
+	boost::asio::io_context m_work_io_context;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+	std::thread m_work_thread;
+	char *m_data = nullptr;
+	std::size_t m_size = 0;
+	std::uint64_t m_next_sequence = 0;
+	std::atomic<bool> m_run{true};
+};
+
+} // namespace services
+
+#endif // SERVICES_SHARED_EVENT_RING_HPP
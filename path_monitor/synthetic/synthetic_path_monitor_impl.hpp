@@ -0,0 +1,501 @@
+//
+// synthetic_path_monitor_impl.hpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_SYNTHETIC_PATH_MONITOR_IMPL_HPP
+#define SERVICES_SYNTHETIC_PATH_MONITOR_IMPL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "../basic_path_monitor.hpp"
+#include "../event_batch.hpp"
+#include "../event_queue.hpp"
+#include "../inotify/path_monitor_service.hpp"
+
+namespace services {
+
+/// Path monitor backend whose events are injected by the program instead of
+/// read from the kernel, one at a time, from a generator or from a trace
+/// recorded with synthetic_trace_recorder. It exercises the queueing,
+/// dispatch and handler layers at rates no file system reaches, with results
+/// that depend only on the injected sequence. Watched paths are recorded but
+/// not examined.
+class synthetic_path_monitor_impl
+{
+public:
+	/// Number of events queued under one lock by generate() and replay().
+	static constexpr std::size_t batch_size = 1024;
+
+	synthetic_path_monitor_impl(const std::string &identifier,
+				    std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+		: m_identifier(identifier),
+		m_events(resource)
+	{
+	}
+
+	/// Return service identifier.
+	const std::string identifier()
+	{
+		return m_identifier;
+	}
+
+	/// Nothing to start; events are injected.
+	void begin_read()
+	{
+	}
+
+	/// There is no descriptor to read.
+	int native_handle() const
+	{
+		return -1;
+	}
+
+	void add_path(const std::filesystem::path &path, const watch_options &, std::system_error &se)
+	{
+		std::unique_lock<std::mutex> lk(m_events_mutex);
+
+		if (std::find(m_paths.begin(), m_paths.end(), path) == m_paths.end())
+			m_paths.push_back(path);
+
+		se = operation_succeeded();
+	}
+
+	void remove_path(const std::filesystem::path &path, std::system_error &se)
+	{
+		std::unique_lock<std::mutex> lk(m_events_mutex);
+
+		m_paths.erase(std::remove(m_paths.begin(), m_paths.end(), path), m_paths.end());
+
+		se = operation_succeeded();
+	}
+
+	void save_snapshot(const std::filesystem::path &, std::system_error &se)
+	{
+		not_supported("save_snapshot", se);
+	}
+
+	void restore_snapshot(const std::filesystem::path &, std::system_error &se)
+	{
+		not_supported("restore_snapshot", se);
+	}
+
+	void set_snapshot(const std::filesystem::path &, std::chrono::steady_clock::duration, std::system_error &se)
+	{
+		not_supported("set_snapshot", se);
+	}
+
+	void set_watch_budget(std::size_t, std::chrono::steady_clock::duration, std::system_error &se)
+	{
+		not_supported("set_watch_budget", se);
+	}
+
+	void set_batch_sink(std::shared_ptr<event_batch_sink>, std::system_error &se)
+	{
+		not_supported("set_batch_sink", se);
+	}
+
+	std::shared_ptr<const directory_listing> list_directory(const std::filesystem::path &, std::system_error &se)
+	{
+		not_supported("list_directory", se);
+
+		return nullptr;
+	}
+
+	path_monitor_stats stats()
+	{
+		path_monitor_stats s;
+
+		std::unique_lock<std::mutex> lk(m_events_mutex);
+
+		s.queued_events = m_events.size();
+		s.queued_by_priority = m_events.depths();
+
+		return s;
+	}
+
+	void add_sink(std::shared_ptr<path_monitor_event_sink> sink)
+	{
+		std::unique_lock<std::mutex> lk(m_sinks_mutex);
+
+		m_sinks.push_back(sink);
+	}
+
+	void remove_sink(std::shared_ptr<path_monitor_event_sink> sink)
+	{
+		std::unique_lock<std::mutex> lk(m_sinks_mutex);
+
+		m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink), m_sinks.end());
+	}
+
+	/// Make injection block while limit events are queued, so that a
+	/// producer runs at the rate of the consumers. Zero removes the limit.
+	void set_queue_limit(std::size_t limit)
+	{
+		std::unique_lock<std::mutex> lk(m_events_mutex);
+
+		m_limit = limit;
+		m_space_cond.notify_all();
+	}
+
+	/// Queue one event.
+	void inject(path_monitor_event ev, watch_priority priority = watch_priority::normal)
+	{
+		std::vector<path_monitor_event> batch;
+
+		batch.push_back(std::move(ev));
+		queue(batch, priority);
+	}
+
+	/// Queue count events returned by generator(). Returns the number
+	/// queued, less than count if the monitor was destroyed.
+	template <typename Generator>
+	std::size_t generate(Generator &&generator, std::size_t count,
+			     watch_priority priority = watch_priority::normal)
+	{
+		std::vector<path_monitor_event> batch;
+		std::size_t queued = 0;
+
+		batch.reserve(std::min(count, batch_size));
+
+		while (queued < count) {
+			std::size_t n = std::min(count - queued, batch_size);
+
+			for (std::size_t i = 0; i < n; ++i)
+				batch.push_back(generator());
+
+			if (!queue(batch, priority))
+				break;
+
+			queued += n;
+		}
+
+		return queued;
+	}
+
+	/// Queue the events of a trace recorded by synthetic_trace_recorder.
+	/// Returns the number queued.
+	std::size_t replay(const std::filesystem::path &trace, std::system_error &se)
+	{
+		std::ifstream ifs(trace);
+
+		if (!ifs) {
+			se = std::system_error(std::make_error_code(std::errc::no_such_file_or_directory),
+					       "service::synthetic_path_monitor_impl::replay: opening \"" + trace.string() + "\" failed");
+
+			return 0;
+		}
+
+		std::vector<path_monitor_event> batch;
+		std::string line;
+		std::size_t queued = 0;
+		std::size_t number = 0;
+
+		while (std::getline(ifs, line)) {
+			++number;
+
+			path_monitor_event ev;
+
+			if (!parse_trace_line(line, ev)) {
+				se = std::system_error(std::make_error_code(std::errc::invalid_argument),
+						       "service::synthetic_path_monitor_impl::replay: malformed line " +
+						       std::to_string(number) + " in \"" + trace.string() + "\"");
+
+				return queued;
+			}
+
+			batch.push_back(std::move(ev));
+
+			if (batch.size() == batch_size) {
+				if (!queue(batch))
+					break;
+
+				queued += batch_size;
+			}
+		}
+
+		auto n = batch.size();
+
+		if (queue(batch))
+			queued += n;
+
+		se = operation_succeeded();
+
+		return queued;
+	}
+
+	/// Format an event as a trace line, without the newline.
+	static std::string format_trace_line(const path_monitor_event &ev)
+	{
+		return std::to_string(static_cast<int>(ev.event)) + '\t' + ev.parent_path.string() + '\t' + ev.path.string();
+	}
+
+	/// Parse a trace line written by format_trace_line().
+	static bool parse_trace_line(const std::string &line, path_monitor_event &ev)
+	{
+		auto first = line.find('\t');
+		auto second = first == std::string::npos ? first : line.find('\t', first + 1);
+
+		if (second == std::string::npos or first == 0 or first > 2)
+			return false;
+
+		int type = 0;
+
+		for (std::size_t i = 0; i < first; ++i) {
+			if (line[i] < '0' or line[i] > '9')
+				return false;
+
+			type = type * 10 + (line[i] - '0');
+		}
+
+		if (type > static_cast<int>(path_monitor_event::type::ready))
+			return false;
+
+		ev = path_monitor_event(line.substr(first + 1, second - first - 1), line.substr(second + 1),
+					static_cast<path_monitor_event::type>(type));
+
+		return true;
+	}
+
+	/// Destroy a path monitor implementation.
+	void destroy()
+	{
+		std::function<void()> ready;
+
+		{
+			std::unique_lock<std::mutex> lk(m_events_mutex);
+
+			m_run = false;
+			ready.swap(m_ready_handler);
+		}
+
+		m_events_cond.notify_all();
+		m_space_cond.notify_all();
+
+		if (ready)
+			ready();
+	}
+
+	/// Get earliest injected event (FIFO).
+	path_monitor_event popfront_event(std::system_error &se)
+	{
+		std::unique_lock<std::mutex> lk(m_events_mutex);
+
+		while (m_run && m_events.empty())
+			m_events_cond.wait(lk);
+
+		path_monitor_event ev;
+
+		if (!m_events.empty()) {
+			ev = m_events.pop_front();
+
+			// Wake a blocked producer once half the queue has drained.
+			if (m_limit and m_events.size() == m_limit / 2)
+				m_space_cond.notify_one();
+
+			se = operation_succeeded();
+		} else {
+			se = std::system_error(std::error_code(static_cast<int>(std::errc::operation_canceled), std::system_category()),
+					       "service::synthetic_path_monitor_impl::popfront_event: operation canceled");
+		}
+
+		return ev;
+	}
+
+	/// Move up to max queued events to the end of evs without waiting.
+	void popfront_events(std::vector<path_monitor_event> &evs, std::size_t max, std::system_error &se)
+	{
+		std::unique_lock<std::mutex> lk(m_events_mutex);
+
+		for (std::size_t i = 0; i < max and !m_events.empty(); ++i)
+			evs.push_back(m_events.pop_front());
+
+		if (m_limit and m_events.size() < m_limit)
+			m_space_cond.notify_one();
+
+		if (evs.empty() and !m_run) {
+			se = std::system_error(std::error_code(static_cast<int>(std::errc::operation_canceled), std::system_category()),
+					       "service::synthetic_path_monitor_impl::popfront_events: operation canceled");
+		} else {
+			se = operation_succeeded();
+		}
+	}
+
+	/// Have ready called once when the next events are queued or the
+	/// monitor is destroyed, unless either already happened.
+	bool notify_when_ready(std::function<void()> ready)
+	{
+		std::unique_lock<std::mutex> lk(m_events_mutex);
+
+		if (!m_events.empty() or !m_run)
+			return false;
+
+		m_ready_handler = std::move(ready);
+
+		return true;
+	}
+
+private:
+	void not_supported(const std::string &method, std::system_error &se)
+	{
+		se = std::system_error(std::make_error_code(std::errc::operation_not_supported),
+				       "service::synthetic_path_monitor_impl::" + method + ": not supported");
+	}
+
+	/// Hand a batch to the sinks and queue it under one lock. Returns false
+	/// if the monitor was destroyed.
+	bool queue(std::vector<path_monitor_event> &batch, watch_priority priority = watch_priority::normal)
+	{
+		{
+			std::unique_lock<std::mutex> lk(m_sinks_mutex);
+
+			for (const auto &sink : m_sinks) {
+				for (const auto &ev : batch)
+					sink->consume(ev);
+			}
+		}
+
+		std::unique_lock<std::mutex> lk(m_events_mutex);
+		std::function<void()> ready;
+
+		for (auto &ev : batch) {
+			if (m_limit and m_events.size() >= m_limit) {
+				m_events_cond.notify_all();
+				ready.swap(m_ready_handler);
+
+				if (ready) {
+					lk.unlock();
+					ready();
+					ready = nullptr;
+					lk.lock();
+				}
+
+				while (m_run and m_events.size() >= m_limit)
+					m_space_cond.wait(lk);
+			}
+
+			if (!m_run)
+				break;
+
+			m_events.push_back(std::move(ev), priority);
+		}
+
+		m_events_cond.notify_all();
+		ready.swap(m_ready_handler);
+		batch.clear();
+
+		bool run = m_run;
+
+		lk.unlock();
+
+		if (ready)
+			ready();
+
+		return run;
+	}
+
+	std::string m_identifier;
+	std::vector<std::filesystem::path> m_paths;
+	std::mutex m_sinks_mutex;
+	std::vector<std::shared_ptr<path_monitor_event_sink>> m_sinks;
+	std::mutex m_events_mutex;
+	std::condition_variable m_events_cond;
+	std::condition_variable m_space_cond;
+	std::function<void()> m_ready_handler;
+	bool m_run = true;
+	std::size_t m_limit = 0;
+	priority_event_queue m_events;
+};
+
+/// Deterministic stream of added, modified and removed events spread over
+/// a number of directories and file names, for synthetic_path_monitor_impl.
+class synthetic_event_generator
+{
+public:
+	synthetic_event_generator(std::uint64_t seed, std::size_t directories = 16, std::size_t files = 1024,
+				  const std::filesystem::path &root = "/synthetic")
+		: m_rng(seed),
+		m_files(files)
+	{
+		for (std::size_t i = 0; i < directories; ++i)
+			m_directories.push_back(root / ("d" + std::to_string(i)));
+	}
+
+	path_monitor_event operator()()
+	{
+		auto r = m_rng();
+		auto &dir = m_directories[r % m_directories.size()];
+		auto file = "f" + std::to_string((r >> 16) % m_files);
+
+		static const path_monitor_event::type types[] = {
+			path_monitor_event::type::added,
+			path_monitor_event::type::modified,
+			path_monitor_event::type::modified,
+			path_monitor_event::type::removed
+		};
+
+		return path_monitor_event(dir, file, types[(r >> 48) % 4]);
+	}
+
+private:
+	std::mt19937_64 m_rng;
+	std::size_t m_files;
+	std::vector<std::filesystem::path> m_directories;
+};
+
+/// Sink writing the events of a monitor as a trace that
+/// synthetic_path_monitor_impl::replay() injects again.
+class synthetic_trace_recorder
+	: public path_monitor_event_sink
+{
+public:
+	explicit synthetic_trace_recorder(const std::filesystem::path &trace)
+		: m_ofs(trace, std::ios::trunc)
+	{
+	}
+
+	void consume(const path_monitor_event &ev) override
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		m_ofs << synthetic_path_monitor_impl::format_trace_line(ev) << '\n';
+	}
+
+	/// Write buffered lines to the file.
+	void flush()
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		m_ofs.flush();
+	}
+
+private:
+	std::mutex m_mutex;
+	std::ofstream m_ofs;
+};
+
+/// Path monitor fed by injected events.
+typedef basic_path_monitor< path_monitor_service<synthetic_path_monitor_impl> > synthetic_path_monitor;
+
+} // namespace services
+
+#endif // SERVICES_SYNTHETIC_PATH_MONITOR_IMPL_HPP
@@ -0,0 +1,263 @@
+//
+// tree_quiescence.hpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_TREE_QUIESCENCE_HPP
+#define SERVICES_TREE_QUIESCENCE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "basic_path_monitor.hpp"
+
+namespace services {
+
+/// Sink completing waits for paths to stop changing. Every path waited on
+/// has one timer shared by its waiters. Events only record when the path or
+/// a path below it last changed; the timer is re-armed when it expires and
+/// finds that a change pushed its waiters' deadlines back, so a stream of
+/// events costs no timer operations.
+class tree_quiescence
+	: public path_monitor_event_sink,
+	public std::enable_shared_from_this<tree_quiescence>
+{
+public:
+	typedef std::chrono::steady_clock clock_type;
+
+	explicit tree_quiescence(boost::asio::io_context &io_context)
+		: m_io_context(io_context),
+		m_strand(boost::asio::make_strand(io_context))
+	{
+	}
+
+	tree_quiescence(const tree_quiescence &) = delete;
+	tree_quiescence& operator=(const tree_quiescence &) = delete;
+
+	/// Call handler(const std::system_error &) from the io_context once
+	/// nothing changed in or below path for quiet.
+	template <typename Handler>
+	void async_wait(const std::filesystem::path &path, clock_type::duration quiet, Handler handler)
+	{
+		auto key = path.lexically_normal().string();
+
+		while (key.size() > 1 and key.back() == '/')
+			key.pop_back();
+
+		auto deadline = clock_type::now() + quiet;
+
+		{
+			std::unique_lock<std::mutex> lk(m_mutex);
+
+			auto &t = m_trees[key];
+
+			t.waiters.push_back(waiter{ deadline, quiet, std::function<void(const std::system_error &)>(std::move(handler)) });
+
+			if (deadline >= t.armed)
+				return;
+
+			t.armed = deadline;
+		}
+
+		boost::asio::post(m_strand, [self = shared_from_this(), key, deadline]() {
+			self->arm(key, deadline);
+		});
+	}
+
+	/// Record a change to the path of an event and the directories above it.
+	void consume(const path_monitor_event &ev) override
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		if (m_trees.empty())
+			return;
+
+		auto now = clock_type::now();
+		std::string_view dir = ev.parent_path.native();
+
+		m_path.assign(dir);
+
+		if (!ev.path.empty()) {
+			m_path += '/';
+			m_path += ev.path.native();
+		}
+
+		touch(m_path, now);
+
+		for (;;) {
+			touch(dir, now);
+
+			auto slash = dir.rfind('/');
+
+			if (slash == std::string_view::npos)
+				break;
+
+			dir = dir.substr(0, slash ? slash : 1);
+
+			if (slash == 0) {
+				touch(dir, now);
+
+				break;
+			}
+		}
+	}
+
+	/// Complete every wait with std::errc::operation_canceled.
+	void cancel()
+	{
+		auto trees = std::make_shared<std::map<std::string, tree, std::less<>>>();
+
+		{
+			std::unique_lock<std::mutex> lk(m_mutex);
+
+			trees->swap(m_trees);
+		}
+
+		std::vector<waiter> waiters;
+
+		for (auto &t : *trees) {
+			for (auto &w : t.second.waiters)
+				waiters.push_back(std::move(w));
+		}
+
+		// The timers are only used in the strand.
+		boost::asio::post(m_strand, [trees]() {
+			trees->clear();
+		});
+
+		static const std::system_error canceled(
+			std::error_code(static_cast<int>(std::errc::operation_canceled), std::system_category()),
+			"service::tree_quiescence::cancel: operation canceled");
+
+		for (auto &w : waiters)
+			boost::asio::post(m_io_context, std::bind(std::move(w.handler), canceled));
+	}
+
+private:
+	struct waiter
+	{
+		clock_type::time_point deadline;
+		clock_type::duration quiet;
+		std::function<void(const std::system_error &)> handler;
+	};
+
+	struct tree
+	{
+		clock_type::time_point last_change = clock_type::time_point::min();
+		clock_type::time_point armed = clock_type::time_point::max();
+		std::vector<waiter> waiters;
+		std::shared_ptr<boost::asio::steady_timer> timer;
+	};
+
+	void touch(std::string_view path, clock_type::time_point now)
+	{
+		auto it = m_trees.find(path);
+
+		if (it != m_trees.end())
+			it->second.last_change = now;
+	}
+
+	/// Wait for deadline on the timer of a path; runs in the strand.
+	void arm(const std::string &key, clock_type::time_point deadline)
+	{
+		std::shared_ptr<boost::asio::steady_timer> timer;
+
+		{
+			std::unique_lock<std::mutex> lk(m_mutex);
+
+			auto it = m_trees.find(key);
+
+			// Cancelled, or a later arm() superseded this one.
+			if (it == m_trees.end() or it->second.armed != deadline)
+				return;
+
+			if (!it->second.timer)
+				it->second.timer = std::make_shared<boost::asio::steady_timer>(m_strand);
+
+			timer = it->second.timer;
+		}
+
+		timer->expires_at(deadline);
+		timer->async_wait([self = shared_from_this(), key, deadline](const boost::system::error_code &ec) {
+			if (!ec)
+				self->expire(key, deadline);
+		});
+	}
+
+	/// Complete the waiters of a path that stayed quiet for them and re-arm
+	/// for the rest; runs in the strand.
+	void expire(const std::string &key, clock_type::time_point deadline)
+	{
+		std::vector<waiter> done;
+		auto next = clock_type::time_point::max();
+
+		{
+			std::unique_lock<std::mutex> lk(m_mutex);
+
+			auto it = m_trees.find(key);
+
+			if (it == m_trees.end() or it->second.armed != deadline)
+				return;
+
+			auto &t = it->second;
+			auto now = clock_type::now();
+
+			for (auto &w : t.waiters) {
+				if (t.last_change != clock_type::time_point::min())
+					w.deadline = std::max(w.deadline, t.last_change + w.quiet);
+
+				if (w.deadline > now)
+					next = std::min(next, w.deadline);
+			}
+
+			auto quiet = std::partition(t.waiters.begin(), t.waiters.end(), [now](const waiter &w) {
+				return w.deadline > now;
+			});
+
+			std::move(quiet, t.waiters.end(), std::back_inserter(done));
+			t.waiters.erase(quiet, t.waiters.end());
+
+			if (t.waiters.empty())
+				m_trees.erase(it);
+			else
+				t.armed = next;
+		}
+
+		if (next != clock_type::time_point::max())
+			arm(key, next);
+
+		for (auto &w : done)
+			w.handler(operation_succeeded());
+	}
+
+	boost::asio::io_context &m_io_context;
+	boost::asio::strand<boost::asio::io_context::executor_type> m_strand;
+	std::mutex m_mutex;
+	std::map<std::string, tree, std::less<>> m_trees;
+	std::string m_path;	// Scratch for consume().
+};
+
+} // namespace services
+
+#endif // SERVICES_TREE_QUIESCENCE_HPP
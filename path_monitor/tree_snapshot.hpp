@@ -0,0 +1,481 @@
+//
+// tree_snapshot.hpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef SERVICES_TREE_SNAPSHOT_HPP
+#define SERVICES_TREE_SNAPSHOT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "basic_path_monitor.hpp"
+
+namespace services {
+
+/// State of a single directory entry as recorded by a snapshot or a live scan.
+struct directory_entry_state
+{
+	std::string name;
+	std::uint64_t inode = 0;
+	std::uint64_t size = 0;
+	std::int64_t mtime = 0;		// Nanoseconds since epoch.
+};
+
+/// Scan the entries of a directory without following symbolic links. Entries
+/// are returned sorted by name.
+inline std::vector<directory_entry_state> scan_directory(const std::filesystem::path &path, std::error_code &ec)
+{
+	std::vector<directory_entry_state> entries;
+
+	DIR *dir = ::opendir(path.c_str());
+
+	if (!dir) {
+		ec = std::error_code(errno, std::system_category());
+
+		return entries;
+	}
+
+	while (dirent *de = ::readdir(dir)) {
+		if (!std::strcmp(de->d_name, ".") or !std::strcmp(de->d_name, ".."))
+			continue;
+
+		struct stat st;
+
+		// The entry may vanish between readdir() and fstatat(); skip it.
+		if (::fstatat(::dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+			continue;
+
+		directory_entry_state entry;
+		entry.name = de->d_name;
+		entry.inode = st.st_ino;
+		entry.size = st.st_size;
+		entry.mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+		entries.push_back(std::move(entry));
+	}
+
+	::closedir(dir);
+
+	std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.name < b.name; });
+
+	ec = std::error_code();
+
+	return entries;
+}
+
+/// On-disk layout of a tree snapshot. All integers are native endian; the file
+/// is only meant to be read back on the host that wrote it.
+///
+/// [header][directory records, sorted by name][entry records][name blob]
+///
+/// Entry records of a directory are contiguous and sorted by name so that a
+/// directory can be located with a binary search and diffed with a merge join
+/// without touching the rest of the file.
+namespace tree_snapshot_format {
+
+constexpr char magic[8] = { 'P', 'M', 'S', 'N', 'A', 'P', '0', '1' };
+constexpr std::uint32_t version = 1;
+
+struct header
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t directory_count;
+	std::uint64_t entry_count;
+	std::uint64_t names_size;
+};
+
+struct directory
+{
+	std::uint32_t name_offset;
+	std::uint32_t name_length;
+	std::uint64_t first_entry;
+	std::uint64_t entry_count;
+};
+
+struct entry
+{
+	std::uint64_t inode;
+	std::uint64_t size;
+	std::int64_t mtime;
+	std::uint32_t name_offset;
+	std::uint32_t name_length;
+};
+
+} // namespace tree_snapshot_format
+
+/// Memory mapped, lazily loaded tree snapshot.
+class tree_snapshot
+{
+public:
+	/// View of a single entry within a mapped snapshot.
+	struct entry_view
+	{
+		std::string_view name;
+		std::uint64_t inode;
+		std::uint64_t size;
+		std::int64_t mtime;
+	};
+
+	tree_snapshot() = default;
+
+	tree_snapshot(const tree_snapshot &) = delete;
+	tree_snapshot& operator=(const tree_snapshot &) = delete;
+
+	~tree_snapshot()
+	{
+		close();
+	}
+
+	/// Map a snapshot file. Only the header and the directory table are
+	/// validated; entry pages are faulted in when a directory is looked up.
+	void open(const std::filesystem::path &file, std::system_error &se)
+	{
+		close();
+
+		int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (fd == -1) {
+			se = std::system_error(std::error_code(errno, std::system_category()),
+					       "service::tree_snapshot::open: open for \"" + file.string() + "\" failed");
+
+			return;
+		}
+
+		struct stat st;
+
+		if (::fstat(fd, &st) == -1) {
+			se = std::system_error(std::error_code(errno, std::system_category()),
+					       "service::tree_snapshot::open: fstat for \"" + file.string() + "\" failed");
+			::close(fd);
+
+			return;
+		}
+
+		m_size = st.st_size;
+
+		if (m_size < sizeof(tree_snapshot_format::header)) {
+			::close(fd);
+			invalid(file, se);
+
+			return;
+		}
+
+		void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+
+		if (data == MAP_FAILED) {
+			se = std::system_error(std::error_code(errno, std::system_category()),
+					       "service::tree_snapshot::open: mmap for \"" + file.string() + "\" failed");
+			m_size = 0;
+
+			return;
+		}
+
+		m_data = static_cast<const char*>(data);
+
+		const auto *h = header();
+
+		std::uint64_t directories_end = sizeof(*h) + std::uint64_t(h->directory_count) * sizeof(tree_snapshot_format::directory);
+		std::uint64_t entries_end = directories_end + h->entry_count * sizeof(tree_snapshot_format::entry);
+
+		if (std::memcmp(h->magic, tree_snapshot_format::magic, sizeof(h->magic)) or
+		    h->version != tree_snapshot_format::version or
+		    h->entry_count > m_size or entries_end > m_size or h->names_size != m_size - entries_end) {
+			close();
+			invalid(file, se);
+
+			return;
+		}
+
+		m_directories = reinterpret_cast<const tree_snapshot_format::directory*>(m_data + sizeof(*h));
+		m_entries = reinterpret_cast<const tree_snapshot_format::entry*>(m_data + directories_end);
+		m_names = m_data + entries_end;
+
+		se = operation_succeeded();
+	}
+
+	void close()
+	{
+		if (m_data)
+			::munmap(const_cast<char*>(m_data), m_size);
+
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	bool is_open() const
+	{
+		return m_data != nullptr;
+	}
+
+	/// Look up the recorded entries of a directory. Returns false if the
+	/// directory was not part of the snapshot.
+	bool find(const std::string &directory, std::vector<entry_view> &entries) const
+	{
+		entries.clear();
+
+		if (!m_data)
+			return false;
+
+		const auto *begin = m_directories;
+		const auto *end = m_directories + header()->directory_count;
+
+		const auto *it = std::lower_bound(begin, end, directory, [this](const auto &d, const std::string &name) {
+			return this->name(d.name_offset, d.name_length) < name;
+		});
+
+		if (it == end or name(it->name_offset, it->name_length) != directory)
+			return false;
+
+		if (it->first_entry + it->entry_count > header()->entry_count)
+			return false;
+
+		entries.reserve(it->entry_count);
+
+		for (const auto *e = m_entries + it->first_entry; e != m_entries + it->first_entry + it->entry_count; ++e)
+			entries.push_back(entry_view{ name(e->name_offset, e->name_length), e->inode, e->size, e->mtime });
+
+		return true;
+	}
+
+	/// Write a snapshot of the given directories. The file is written next to
+	/// its final location and renamed into place so readers never observe a
+	/// partially written snapshot.
+	static void write(const std::filesystem::path &file,
+			  std::vector<std::pair<std::string, std::vector<directory_entry_state>>> directories,
+			  std::system_error &se)
+	{
+		std::sort(directories.begin(), directories.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+		std::string names;
+		std::vector<tree_snapshot_format::directory> directory_records;
+		std::vector<tree_snapshot_format::entry> entry_records;
+
+		directory_records.reserve(directories.size());
+
+		for (const auto &d : directories) {
+			directory_records.push_back({ static_cast<std::uint32_t>(names.size()), static_cast<std::uint32_t>(d.first.size()),
+						      entry_records.size(), d.second.size() });
+			names += d.first;
+
+			for (const auto &e : d.second) {
+				entry_records.push_back({ e.inode, e.size, e.mtime, static_cast<std::uint32_t>(names.size()),
+							  static_cast<std::uint32_t>(e.name.size()) });
+				names += e.name;
+			}
+		}
+
+		tree_snapshot_format::header h;
+		std::memcpy(h.magic, tree_snapshot_format::magic, sizeof(h.magic));
+		h.version = tree_snapshot_format::version;
+		h.directory_count = directory_records.size();
+		h.entry_count = entry_records.size();
+		h.names_size = names.size();
+
+		auto tmp = file;
+		tmp += ".tmp";
+
+		int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+		if (fd == -1) {
+			se = std::system_error(std::error_code(errno, std::system_category()),
+					       "service::tree_snapshot::write: open for \"" + tmp.string() + "\" failed");
+
+			return;
+		}
+
+		bool ok = write_all(fd, &h, sizeof(h)) and
+			  write_all(fd, directory_records.data(), directory_records.size() * sizeof(directory_records[0])) and
+			  write_all(fd, entry_records.data(), entry_records.size() * sizeof(entry_records[0])) and
+			  write_all(fd, names.data(), names.size()) and
+			  ::fsync(fd) == 0;
+
+		int error = errno;
+
+		::close(fd);
+
+		if (!ok or ::rename(tmp.c_str(), file.c_str()) == -1) {
+			se = std::system_error(std::error_code(ok ? errno : error, std::system_category()),
+					       "service::tree_snapshot::write: writing \"" + file.string() + "\" failed");
+			::unlink(tmp.c_str());
+
+			return;
+		}
+
+		se = operation_succeeded();
+	}
+
+	/// Compute the events that turn the recorded entries of a directory into
+	/// the live ones. Both inputs must be sorted by name.
+	static void diff(const std::string &directory, const std::vector<entry_view> &recorded,
+			 const std::vector<directory_entry_state> &live, std::vector<path_monitor_event> &events)
+	{
+		std::vector<const entry_view*> removed;
+		std::vector<const directory_entry_state*> added;
+
+		auto r = recorded.begin();
+		auto l = live.begin();
+
+		while (r != recorded.end() or l != live.end()) {
+			if (l == live.end() or (r != recorded.end() and r->name < l->name)) {
+				removed.push_back(&*r++);
+			} else if (r == recorded.end() or l->name < r->name) {
+				added.push_back(&*l++);
+			} else {
+				if (r->inode != l->inode) {
+					events.emplace_back(directory, l->name, path_monitor_event::type::removed);
+					events.emplace_back(directory, l->name, path_monitor_event::type::added);
+				} else if (r->size != l->size or r->mtime != l->mtime) {
+					events.emplace_back(directory, l->name, path_monitor_event::type::modified);
+				}
+
+				++r;
+				++l;
+			}
+		}
+
+		// An entry that disappeared under one name and appeared under another
+		// with the same inode was renamed.
+		if (!removed.empty() and !added.empty()) {
+			std::unordered_multimap<std::uint64_t, std::size_t> added_by_inode;
+
+			added_by_inode.reserve(added.size());
+
+			for (std::size_t i = 0; i < added.size(); ++i)
+				added_by_inode.emplace(added[i]->inode, i);
+
+			for (auto &rm : removed) {
+				auto match = added_by_inode.find(rm->inode);
+
+				if (match == added_by_inode.end())
+					continue;
+
+				auto &a = added[match->second];
+
+				added_by_inode.erase(match);
+
+				events.emplace_back(directory, std::string(rm->name), path_monitor_event::type::renamed_old_name);
+				events.emplace_back(directory, a->name, path_monitor_event::type::renamed_new_name);
+
+				if (a->size != rm->size or a->mtime != rm->mtime)
+					events.emplace_back(directory, a->name, path_monitor_event::type::modified);
+
+				a = nullptr;
+				rm = nullptr;
+			}
+		}
+
+		for (const auto *rm : removed) {
+			if (rm)
+				events.emplace_back(directory, std::string(rm->name), path_monitor_event::type::removed);
+		}
+
+		for (const auto *a : added) {
+			if (a)
+				events.emplace_back(directory, a->name, path_monitor_event::type::added);
+		}
+	}
+
+private:
+	const tree_snapshot_format::header *header() const
+	{
+		return reinterpret_cast<const tree_snapshot_format::header*>(m_data);
+	}
+
+	std::string_view name(std::uint32_t offset, std::uint32_t length) const
+	{
+		if (std::uint64_t(offset) + length > header()->names_size)
+			return std::string_view();
+
+		return std::string_view(m_names + offset, length);
+	}
+
+	static void invalid(const std::filesystem::path &file, std::system_error &se)
+	{
+		se = std::system_error(std::make_error_code(std::errc::invalid_argument),
+				       "service::tree_snapshot::open: \"" + file.string() + "\" is not a valid snapshot");
+	}
+
+	static bool write_all(int fd, const void *data, std::size_t size)
+	{
+		const char *p = static_cast<const char*>(data);
+
+		while (size) {
+			ssize_t n = ::write(fd, p, size);
+
+			if (n == -1) {
+				if (errno == EINTR)
+					continue;
+
+				return false;
+			}
+
+			p += n;
+			size -= n;
+		}
+
+		return true;
+	}
+
+	const char *m_data = nullptr;
+	std::size_t m_size = 0;
+	const tree_snapshot_format::directory *m_directories = nullptr;
+	const tree_snapshot_format::entry *m_entries = nullptr;
+	const char *m_names = nullptr;
+};
+
+/// Run a job for every index in [0, count) on a bounded set of threads.
+template <typename Function>
+void parallel_for_each_index(std::size_t count, Function function)
+{
+	std::size_t workers = std::min<std::size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+
+	if (workers <= 1) {
+		for (std::size_t i = 0; i < count; ++i)
+			function(i);
+
+		return;
+	}
+
+	std::atomic<std::size_t> next(0);
+	std::vector<std::thread> threads;
+
+	threads.reserve(workers);
+
+	for (std::size_t w = 0; w < workers; ++w) {
+		threads.emplace_back([&]() {
+			for (std::size_t i = next++; i < count; i = next++)
+				function(i);
+		});
+	}
+
+	for (auto &t : threads)
+		t.join();
+}
+
+} // namespace services
+
+#endif // SERVICES_TREE_SNAPSHOT_HPP
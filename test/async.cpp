@@ -9,6 +9,9 @@
 #include "path_monitor/path_monitor.hpp"
 #include "directory.hpp"
 
+#include <boost/bind/bind.hpp>
+#include <boost/core/ref.hpp>
+
 boost::asio::io_context io_context;
 
 void create_file_handler(const std::system_error &se, const services::path_monitor_event &ev)
@@ -0,0 +1,194 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "path_monitor/path_monitor_daemon.hpp"
+#include "directory.hpp"
+
+#include <boost/bind/bind.hpp>
+#include <boost/core/ref.hpp>
+
+#define TEST_SOCKET "path_monitor_test.sock"
+
+TEST(TestDAEMON, SharedWatch)
+{
+	directory dir(TEST_DIR1);
+
+	boost::asio::io_context daemon_io_context;
+	services::path_monitor_daemon daemon(daemon_io_context, TEST_SOCKET);
+	auto work = boost::asio::make_work_guard(daemon_io_context);
+	std::thread t(boost::bind(&boost::asio::io_context::run, boost::ref(daemon_io_context)));
+
+	boost::asio::io_context io_context;
+	services::path_monitor_client client1(io_context);
+	services::path_monitor_client client2(io_context);
+	std::system_error se;
+
+	client1.connect(TEST_SOCKET, se);
+	EXPECT_EQ(se.code(), std::error_code());
+	client2.connect(TEST_SOCKET, se);
+	EXPECT_EQ(se.code(), std::error_code());
+
+	client1.subscribe(TEST_DIR1, services::path_monitor_protocol::all_events, "", se);
+	EXPECT_EQ(se.code(), std::error_code());
+
+	// Only names matching the filter and only removals.
+	client2.subscribe(TEST_DIR1, services::path_monitor_protocol::event_mask(services::path_monitor_event::type::removed),
+			  "*2.txt", se);
+	EXPECT_EQ(se.code(), std::error_code());
+
+	dir.create_file(TEST_FILE1);
+	dir.create_file(TEST_FILE2);
+	dir.remove_file(TEST_FILE1);
+	dir.remove_file(TEST_FILE2);
+
+	services::path_monitor_event ev = client1.monitor(se);
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(ev.parent_path, TEST_DIR1);
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::added));
+
+	ev = client2.monitor(se);
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(ev.parent_path, TEST_DIR1);
+	EXPECT_EQ(ev.path, TEST_FILE2);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::removed));
+
+	client1.async_monitor([](const std::system_error &se, const services::path_monitor_event &ev) {
+		EXPECT_EQ(se.code(), std::error_code());
+		EXPECT_EQ(ev.path, TEST_FILE2);
+		EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::added));
+	});
+
+	io_context.run();
+
+	client1.close();
+	client2.close();
+
+	boost::asio::post(daemon_io_context, [&daemon]() { daemon.stop(); });
+	work.reset();
+	t.join();
+}
+
+TEST(TestDAEMON, SubscribeFailure)
+{
+	boost::asio::io_context daemon_io_context;
+	services::path_monitor_daemon daemon(daemon_io_context, TEST_SOCKET);
+	auto work = boost::asio::make_work_guard(daemon_io_context);
+	std::thread t(boost::bind(&boost::asio::io_context::run, boost::ref(daemon_io_context)));
+
+	boost::asio::io_context io_context;
+	services::path_monitor_client client(io_context);
+	std::system_error se;
+
+	client.connect(TEST_SOCKET, se);
+	EXPECT_EQ(se.code(), std::error_code());
+
+	client.subscribe(TEST_DIR2, services::path_monitor_protocol::all_events, "", se);
+	EXPECT_EQ(se.code().value(), ENOENT);
+
+	client.close();
+
+	boost::asio::post(daemon_io_context, [&daemon]() { daemon.stop(); });
+	work.reset();
+	t.join();
+}
+
+TEST(TestDAEMON, ConnectFailure)
+{
+	::unlink(TEST_SOCKET);
+
+	boost::asio::io_context io_context;
+	services::path_monitor_client client(io_context);
+	std::system_error se;
+
+	client.connect(TEST_SOCKET, se);
+	EXPECT_EQ(se.code().category(), std::system_category());
+	EXPECT_TRUE(se.code().value() == ENOENT or se.code().value() == ECONNREFUSED);
+}
+
+TEST(TestDAEMON, ProtocolLimits)
+{
+	directory dir(TEST_DIR1);
+
+	boost::asio::io_context daemon_io_context;
+	services::path_monitor_daemon daemon(daemon_io_context, TEST_SOCKET);
+	auto work = boost::asio::make_work_guard(daemon_io_context);
+	std::thread t(boost::bind(&boost::asio::io_context::run, boost::ref(daemon_io_context)));
+
+	boost::asio::io_context io_context;
+	boost::asio::local::stream_protocol::socket socket(io_context);
+
+	socket.connect(boost::asio::local::stream_protocol::endpoint(TEST_SOCKET));
+
+	namespace protocol = services::path_monitor_protocol;
+
+	auto request = [&socket](protocol::message m, std::uint32_t id) {
+		std::string frame;
+		auto start = protocol::begin_frame(frame, m);
+
+		protocol::put(frame, id);
+
+		if (m == protocol::message::subscribe) {
+			protocol::put(frame, protocol::all_events);
+			protocol::put(frame, std::string(TEST_DIR1));
+			protocol::put(frame, std::string());
+		}
+
+		protocol::end_frame(frame, start);
+		boost::asio::write(socket, boost::asio::buffer(frame));
+	};
+
+	protocol::frame_reader reader;
+	std::vector<std::int32_t> replies;
+
+	auto reply = [&]() {
+		std::array<char, 256> buffer;
+
+		while (replies.empty()) {
+			reader.append(buffer.data(), socket.read_some(boost::asio::buffer(buffer)));
+			reader.consume([&replies](protocol::frame f) {
+				protocol::message m;
+				std::uint32_t id;
+				std::int32_t error;
+
+				if (f.get(m) and m == protocol::message::subscribed and f.get(id) and f.get(error))
+					replies.push_back(error);
+			});
+		}
+
+		auto error = replies.front();
+
+		replies.erase(replies.begin());
+
+		return error;
+	};
+
+	// An identifier in use is refused until it is unsubscribed.
+	request(protocol::message::subscribe, 1);
+	EXPECT_EQ(reply(), 0);
+	request(protocol::message::subscribe, 1);
+	EXPECT_EQ(reply(), EEXIST);
+	request(protocol::message::unsubscribe, 1);
+	request(protocol::message::subscribe, 1);
+	EXPECT_EQ(reply(), 0);
+
+	// An oversized frame ends the connection instead of being buffered.
+	std::uint32_t length = protocol::max_frame_size + 1;
+	boost::system::error_code ec;
+	std::array<char, 256> buffer;
+
+	boost::asio::write(socket, boost::asio::buffer(&length, sizeof(length)));
+
+	while (!ec)
+		socket.read_some(boost::asio::buffer(buffer), ec);
+
+	EXPECT_EQ(ec, boost::asio::error::eof);
+
+	boost::asio::post(daemon_io_context, [&daemon]() { daemon.stop(); });
+	work.reset();
+	t.join();
+}
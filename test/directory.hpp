@@ -45,6 +45,19 @@ public:
 		std::filesystem::current_path(current_path);
 	}
 
+	void append_file(std::string file, std::string data)
+	{
+		auto current_path = std::filesystem::current_path();
+
+		std::filesystem::current_path(m_name);
+		ASSERT_TRUE(std::filesystem::equivalent(m_name, std::filesystem::current_path()));
+		std::ofstream ofs(file, std::ios::app);
+		ofs << data;
+		ofs.close();
+		ASSERT_TRUE(std::filesystem::exists(file));
+		std::filesystem::current_path(current_path);
+	}
+
 	void rename_file(std::string from, std::string to)
 	{
 		auto current_path = std::filesystem::current_path();
@@ -0,0 +1,207 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "path_monitor/path_monitor.hpp"
+#include "path_monitor/event_journal.hpp"
+#include "directory.hpp"
+
+#define TEST_JOURNAL "path_monitor_test.journal"
+
+boost::asio::io_context io_context;
+
+TEST(TestJOURNAL, JournalEvents)
+{
+	directory dir(TEST_DIR1);
+	directory journal_dir(TEST_JOURNAL);
+
+	auto journal = std::make_shared<services::event_journal>(TEST_JOURNAL);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	pm.add_path(TEST_DIR1, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	pm.add_sink(journal);
+
+	dir.create_file(TEST_FILE1);
+	dir.remove_file(TEST_FILE1);
+
+	// Events are journaled before they are queued.
+	pm.monitor(se);
+	pm.monitor(se);
+
+	services::event_journal_cursor cursor(TEST_JOURNAL, "consumer");
+	services::path_monitor_event ev;
+	std::uint64_t sequence = 0;
+
+	EXPECT_TRUE(cursor.next(ev, sequence, se));
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(sequence, 1u);
+	EXPECT_EQ(ev.parent_path, TEST_DIR1);
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::added));
+
+	EXPECT_TRUE(cursor.next(ev, sequence, se));
+	EXPECT_EQ(sequence, 2u);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::removed));
+
+	EXPECT_FALSE(cursor.next(ev, sequence, se));
+	EXPECT_EQ(se.code(), std::error_code());
+}
+
+TEST(TestJOURNAL, ResumeAndRecycle)
+{
+	directory journal_dir(TEST_JOURNAL);
+	std::system_error se;
+
+	services::event_journal_options options;
+	options.segment_size = 4096;
+	options.retained_segments = 1;
+
+	services::event_journal journal(TEST_JOURNAL, options);
+
+	{
+		services::event_journal_cursor cursor(TEST_JOURNAL, "consumer");
+	}
+
+	for (int i = 0; i < 1000; ++i)
+		journal.append(services::path_monitor_event(TEST_DIR1, std::to_string(i), services::path_monitor_event::type::added), se);
+
+	// The cursor holds every segment back.
+	{
+		services::event_journal_cursor cursor(TEST_JOURNAL, "consumer");
+		services::path_monitor_event ev;
+		std::uint64_t sequence = 0;
+
+		for (int i = 0; i < 600; ++i) {
+			ASSERT_TRUE(cursor.next(ev, sequence, se));
+			EXPECT_EQ(ev.path, std::to_string(i));
+		}
+
+		cursor.acknowledge(sequence + 1, se);
+
+		EXPECT_EQ(se.code(), std::error_code());
+	}
+
+	// A restarted consumer resumes after the acknowledged event.
+	services::event_journal_cursor cursor(TEST_JOURNAL, "consumer");
+	services::path_monitor_event ev;
+	std::uint64_t sequence = 0;
+
+	ASSERT_TRUE(cursor.next(ev, sequence, se));
+	EXPECT_EQ(sequence, 601u);
+	EXPECT_EQ(ev.path, "600");
+
+	// Segments before the acknowledged event are recycled on the next roll.
+	for (int i = 1000; i < 1200; ++i)
+		journal.append(services::path_monitor_event(TEST_DIR1, std::to_string(i), services::path_monitor_event::type::added), se);
+
+	cursor.seek(1);
+
+	EXPECT_FALSE(cursor.next(ev, sequence, se));
+	EXPECT_EQ(se.code(), std::make_error_code(std::errc::result_out_of_range));
+
+	cursor.seek(601);
+
+	for (int i = 600; i < 1200; ++i) {
+		ASSERT_TRUE(cursor.next(ev, sequence, se));
+		EXPECT_EQ(ev.path, std::to_string(i));
+	}
+
+	EXPECT_FALSE(cursor.next(ev, sequence, se));
+}
+
+TEST(TestJOURNAL, DroppedEvents)
+{
+	directory journal_dir(TEST_JOURNAL);
+
+	// A stray segment-like file is ignored.
+	std::ofstream(TEST_JOURNAL "/notes.seg").close();
+
+	services::event_journal journal(TEST_JOURNAL);
+	std::system_error se;
+
+	EXPECT_EQ(journal.dropped(se), 0u);
+	EXPECT_EQ(se.code(), std::error_code());
+
+	// An event the journal cannot take is counted rather than lost silently.
+	journal.consume(services::path_monitor_event(TEST_DIR1, std::string(UINT16_MAX + 1, 'x'),
+						     services::path_monitor_event::type::added));
+	journal.consume(services::path_monitor_event(TEST_DIR1, TEST_FILE1, services::path_monitor_event::type::added));
+
+	EXPECT_EQ(journal.dropped(se), 1u);
+	EXPECT_EQ(se.code(), std::make_error_code(std::errc::filename_too_long));
+	EXPECT_EQ(journal.next_sequence(), 2u);
+}
+
+TEST(TestJOURNAL, SegmentLimit)
+{
+	directory journal_dir(TEST_JOURNAL);
+	std::system_error se;
+
+	services::event_journal_options options;
+	options.segment_size = 4096;
+	options.max_segments = 2;
+
+	services::event_journal journal(TEST_JOURNAL, options);
+
+	// A cursor that never acknowledges does not hold segments past the limit.
+	services::event_journal_cursor cursor(TEST_JOURNAL, "idle");
+
+	for (int i = 0; i < 1000; ++i)
+		journal.append(services::path_monitor_event(TEST_DIR1, std::to_string(i), services::path_monitor_event::type::added), se);
+
+	EXPECT_EQ(services::event_journal_format::list_segments(TEST_JOURNAL).size(), 2u);
+
+	services::path_monitor_event ev;
+	std::uint64_t sequence = 0;
+
+	EXPECT_FALSE(cursor.next(ev, sequence, se));
+	EXPECT_EQ(se.code(), std::make_error_code(std::errc::result_out_of_range));
+}
+
+TEST(TestJOURNAL, StaleSegmentHeader)
+{
+	directory journal_dir(TEST_JOURNAL);
+	std::system_error se;
+
+	services::event_journal_options options;
+	options.segment_size = 4096;
+
+	std::uint64_t next_sequence;
+
+	{
+		services::event_journal journal(TEST_JOURNAL, options);
+
+		for (int i = 0; i < 10; ++i)
+			journal.append(services::path_monitor_event(TEST_DIR1, std::to_string(i), services::path_monitor_event::type::added), se);
+
+		next_sequence = journal.next_sequence();
+	}
+
+	// A crash right after a segment was recycled into place leaves it with
+	// the header and records of its previous use.
+	std::filesystem::copy_file(TEST_JOURNAL "/" + services::event_journal_format::segment_name(1),
+				   TEST_JOURNAL "/" + services::event_journal_format::segment_name(next_sequence));
+
+	services::event_journal journal(TEST_JOURNAL, options);
+
+	EXPECT_EQ(journal.next_sequence(), next_sequence);
+
+	journal.append(services::path_monitor_event(TEST_DIR1, TEST_FILE1, services::path_monitor_event::type::added), se);
+
+	services::event_journal_cursor cursor(TEST_JOURNAL, "consumer");
+	services::path_monitor_event ev;
+	std::uint64_t sequence = 0;
+
+	cursor.seek(next_sequence);
+
+	ASSERT_TRUE(cursor.next(ev, sequence, se));
+	EXPECT_EQ(sequence, next_sequence);
+	EXPECT_EQ(ev.path, TEST_FILE1);
+}
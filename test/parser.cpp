@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "path_monitor/inotify/inotify_parser.hpp"
+#include "path_monitor/inotify/path_monitor_impl.hpp"
+
+namespace {
+
+struct record
+{
+	int wd;
+	std::uint32_t mask;
+	std::uint32_t cookie;
+	std::string name;
+
+	bool operator==(const record &r) const
+	{
+		return wd == r.wd and mask == r.mask and cookie == r.cookie and name == r.name;
+	}
+};
+
+/// Append a record the way the kernel lays it out, the name NUL padded to
+/// the header alignment.
+void append_record(std::string &stream, const record &r)
+{
+	inotify_event iev = {};
+	std::size_t len = r.name.empty() ? 0 : (r.name.size() + sizeof(inotify_event)) & ~(sizeof(inotify_event) - 1);
+
+	iev.wd = r.wd;
+	iev.mask = r.mask;
+	iev.cookie = r.cookie;
+	iev.len = len;
+
+	stream.append(reinterpret_cast<const char*>(&iev), sizeof(iev));
+	stream.append(r.name);
+	stream.append(len - r.name.size(), '\0');
+}
+
+std::vector<record> parse(services::inotify_parser &parser, const std::string &stream,
+			  std::size_t split, bool &ok)
+{
+	std::vector<record> records;
+	auto f = [&records](const services::inotify_record_view &r) {
+		records.push_back(record{ r.wd, r.mask, r.cookie, std::string(r.name) });
+	};
+
+	ok = parser.parse(stream.data(), split, f) and
+	     parser.parse(stream.data() + split, stream.size() - split, f);
+
+	return records;
+}
+
+} // namespace
+
+TEST(TestPARSER, SplitRecords)
+{
+	std::vector<record> expected = {
+		{ 1, IN_CREATE, 0, "a" },
+		{ 2, IN_MOVED_FROM, 7, std::string(255, 'x') },
+		{ 2, IN_MOVED_TO, 7, "fifteen chars.." },
+		{ 3, IN_DELETE_SELF, 0, "" },
+		{ 1, IN_MODIFY, 0, "sixteen chars..." },
+	};
+
+	std::string stream;
+
+	for (const auto &r : expected)
+		append_record(stream, r);
+
+	// Every split point, inside headers and names alike, yields the same
+	// records.
+	for (std::size_t split = 0; split <= stream.size(); ++split) {
+		services::inotify_parser parser;
+		bool ok;
+
+		EXPECT_EQ(parse(parser, stream, split, ok), expected) << "split at " << split;
+		EXPECT_TRUE(ok);
+		EXPECT_EQ(parser.pending(), 0u);
+	}
+}
+
+TEST(TestPARSER, TruncatedRecord)
+{
+	std::string stream;
+
+	append_record(stream, record{ 1, IN_CREATE, 0, "complete" });
+	append_record(stream, record{ 1, IN_CREATE, 0, "truncated" });
+
+	services::inotify_parser parser;
+	std::size_t count = 0;
+
+	EXPECT_TRUE(parser.parse(stream.data(), stream.size() - 3, [&count](const services::inotify_record_view &) {
+		++count;
+	}));
+	EXPECT_EQ(count, 1u);
+	EXPECT_EQ(parser.pending(), stream.size() - 3 - stream.size() / 2);
+
+	EXPECT_TRUE(parser.parse(stream.data() + stream.size() - 3, 3, [&count](const services::inotify_record_view &r) {
+		EXPECT_EQ(r.name, "truncated");
+		++count;
+	}));
+	EXPECT_EQ(count, 2u);
+	EXPECT_EQ(parser.pending(), 0u);
+}
+
+TEST(TestPARSER, CorruptLength)
+{
+	std::string stream;
+
+	append_record(stream, record{ 1, IN_CREATE, 0, "name" });
+
+	inotify_event iev = {};
+
+	iev.len = 1 << 20;
+	stream.append(reinterpret_cast<const char*>(&iev), sizeof(iev));
+
+	services::inotify_parser parser;
+	std::size_t count = 0;
+
+	EXPECT_FALSE(parser.parse(stream.data(), stream.size(), [&count](const services::inotify_record_view &) {
+		++count;
+	}));
+	EXPECT_EQ(count, 1u);
+	EXPECT_EQ(parser.pending(), 0u);
+}
+
+TEST(TestPARSER, CorruptStreamReported)
+{
+	inotify_event iev = {};
+
+	iev.len = 1 << 20;
+
+	std::string stream(reinterpret_cast<const char*>(&iev), sizeof(iev));
+	auto impl = std::make_shared<services::path_monitor_impl>("Corrupt Stream");
+
+	EXPECT_FALSE(impl->consume_read(stream.data(), stream.size()));
+
+	std::vector<services::path_monitor_event> evs;
+	std::system_error se;
+
+	impl->popfront_events(evs, 16, se);
+	EXPECT_TRUE(evs.empty());
+	EXPECT_EQ(se.code(), std::errc::bad_message);
+
+	// A blocked consumer is not left waiting for events that never come.
+	impl->popfront_event(se);
+	EXPECT_EQ(se.code(), std::errc::bad_message);
+	EXPECT_FALSE(impl->notify_when_ready([]() { }));
+
+	impl->destroy();
+}
@@ -0,0 +1,156 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "path_monitor/path_monitor.hpp"
+#include "path_monitor/shared_event_ring.hpp"
+#include "directory.hpp"
+
+#include <sys/wait.h>
+
+#define TEST_RING "/path_monitor_test_ring"
+
+boost::asio::io_context io_context;
+
+TEST(TestRING, PublishedEvents)
+{
+	directory dir(TEST_DIR1);
+
+	auto publisher = std::make_shared<services::shared_event_ring_publisher>(TEST_RING);
+	services::shared_event_ring_reader reader(io_context, TEST_RING);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	pm.add_path(TEST_DIR1, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	pm.add_sink(publisher);
+
+	dir.create_file(TEST_FILE1);
+
+	services::shared_event_view view = reader.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(view.parent_path, TEST_DIR1);
+	EXPECT_EQ(view.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(view.event), static_cast<int>(services::path_monitor_event::type::added));
+	EXPECT_TRUE(reader.valid(view));
+
+	dir.remove_file(TEST_FILE1);
+
+	reader.async_monitor([&reader](const std::system_error &se, const services::shared_event_view &view) {
+		EXPECT_EQ(se.code(), std::error_code());
+		EXPECT_EQ(view.path, TEST_FILE1);
+		EXPECT_EQ(static_cast<int>(view.event), static_cast<int>(services::path_monitor_event::type::removed));
+		EXPECT_TRUE(reader.valid(view));
+	});
+
+	io_context.run();
+	io_context.reset();
+
+	// The monitor's service outlives it; release the publisher so that
+	// it unlinks the ring.
+	pm.remove_sink(publisher);
+}
+
+TEST(TestRING, LappedReader)
+{
+	services::shared_event_ring_options options;
+	options.slot_count = 4;
+
+	services::shared_event_ring_publisher publisher(TEST_RING, options);
+	services::shared_event_ring_reader reader(io_context, TEST_RING);
+
+	for (int i = 0; i < 6; ++i)
+		publisher.publish(services::path_monitor_event::type::added, TEST_DIR1, std::to_string(i));
+
+	std::system_error se;
+	services::shared_event_view view = reader.monitor(se);
+
+	EXPECT_EQ(se.code(), std::make_error_code(std::errc::no_buffer_space));
+
+	view = reader.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(view.path, "3");
+}
+
+TEST(TestRING, StoppedReader)
+{
+	services::shared_event_ring_publisher publisher(TEST_RING);
+	services::shared_event_ring_reader reader(io_context, TEST_RING);
+
+	std::thread t([&reader]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		reader.stop();
+	});
+
+	std::system_error se;
+	reader.monitor(se);
+
+	EXPECT_EQ(se.code().value(), static_cast<int>(std::errc::operation_canceled));
+
+	t.join();
+}
+
+TEST(TestRING, ExclusivePublisher)
+{
+	services::shared_event_ring_publisher publisher(TEST_RING);
+	services::shared_event_ring_reader reader(io_context, TEST_RING);
+
+	// A second publisher must not truncate the ring the reader has mapped.
+	try {
+		services::shared_event_ring_publisher other(TEST_RING);
+
+		ADD_FAILURE() << "second publisher created";
+	} catch (const std::system_error &se) {
+		EXPECT_EQ(se.code().value(), EEXIST);
+	}
+
+	publisher.publish(services::path_monitor_event::type::added, TEST_DIR1, TEST_FILE1);
+
+	std::system_error se;
+	services::shared_event_view view = reader.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(view.path, TEST_FILE1);
+}
+
+TEST(TestRING, StaleSegment)
+{
+	// The ring of a publisher that died without unlinking it.
+	pid_t pid = ::fork();
+
+	if (!pid)
+		::_exit(0);
+
+	::waitpid(pid, nullptr, 0);
+
+	int fd = ::shm_open(TEST_RING, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+	ASSERT_NE(fd, -1);
+	ASSERT_EQ(::ftruncate(fd, sizeof(services::shared_event_ring_format::header)), 0);
+
+	services::shared_event_ring_format::header h = {};
+
+	std::memcpy(h.magic, services::shared_event_ring_format::magic, sizeof(h.magic));
+	h.version = services::shared_event_ring_format::version;
+	h.publisher_pid = pid;
+	ASSERT_EQ(::pwrite(fd, &h, sizeof(h), 0), ssize_t(sizeof(h)));
+	::close(fd);
+
+	services::shared_event_ring_publisher publisher(TEST_RING);
+	services::shared_event_ring_reader reader(io_context, TEST_RING);
+
+	publisher.publish(services::path_monitor_event::type::added, TEST_DIR1, TEST_FILE1);
+
+	std::system_error se;
+	services::shared_event_view view = reader.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(view.path, TEST_FILE1);
+}
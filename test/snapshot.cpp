@@ -0,0 +1,124 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "path_monitor/path_monitor.hpp"
+#include "directory.hpp"
+
+#define TEST_SNAPSHOT "path_monitor_test.snapshot"
+
+boost::asio::io_context io_context;
+
+TEST(TestSNAPSHOT, MissedEvents)
+{
+	directory dir(TEST_DIR1);
+	dir.create_file(TEST_FILE1);
+	dir.create_file(TEST_FILE2);
+
+	std::system_error se;
+
+	{
+		services::path_monitor pm(io_context, "Path Monitor");
+		pm.add_path(TEST_DIR1, se);
+
+		EXPECT_EQ(se.code(), std::error_code());
+
+		pm.set_snapshot(TEST_SNAPSHOT, std::chrono::steady_clock::duration::zero(), se);
+
+		EXPECT_EQ(se.code(), std::error_code());
+	}
+
+	// Changes made while nothing is monitoring. The file is added before the
+	// other is removed so that its inode cannot be reused.
+	dir.rename_file(TEST_FILE1, "renamed.txt");
+	dir.create_file("added.txt");
+	dir.remove_file(TEST_FILE2);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	pm.add_path(TEST_DIR1, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	pm.restore_snapshot(TEST_SNAPSHOT, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	// A live event is delivered after the missed ones.
+	dir.append_file("added.txt", "x");
+
+	services::path_monitor_event ev = pm.monitor(se);
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(ev.parent_path, TEST_DIR1);
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::renamed_old_name));
+
+	ev = pm.monitor(se);
+	EXPECT_EQ(ev.path, "renamed.txt");
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::renamed_new_name));
+
+	ev = pm.monitor(se);
+	EXPECT_EQ(ev.path, TEST_FILE2);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::removed));
+
+	ev = pm.monitor(se);
+	EXPECT_EQ(ev.path, "added.txt");
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::added));
+
+	ev = pm.monitor(se);
+	EXPECT_EQ(ev.path, "added.txt");
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::modified));
+
+	std::filesystem::remove(TEST_SNAPSHOT);
+}
+
+TEST(TestSNAPSHOT, InvalidSnapshot)
+{
+	directory dir(TEST_DIR1);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	pm.add_path(TEST_DIR1, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	dir.create_file(TEST_FILE1);
+
+	pm.restore_snapshot(TEST_DIR1 "/" TEST_FILE1, se);
+
+	EXPECT_EQ(se.code(), std::make_error_code(std::errc::invalid_argument));
+}
+
+TEST(TestSNAPSHOT, OverflowingNamesSize)
+{
+	directory dir(TEST_DIR1);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	pm.add_path(TEST_DIR1, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	// The entry table runs past the end of the file and names_size wraps
+	// the computed file size around to the real one.
+	std::string data(100, '\0');
+	services::tree_snapshot_format::header h = {};
+
+	std::memcpy(h.magic, services::tree_snapshot_format::magic, sizeof(h.magic));
+	h.version = services::tree_snapshot_format::version;
+	h.entry_count = 10;
+
+	std::uint64_t entries_end = sizeof(h) + h.entry_count * sizeof(services::tree_snapshot_format::entry);
+
+	h.names_size = data.size() - entries_end;
+	std::memcpy(data.data(), &h, sizeof(h));
+	std::ofstream(TEST_SNAPSHOT, std::ios::binary) << data;
+
+	pm.restore_snapshot(TEST_SNAPSHOT, se);
+
+	EXPECT_EQ(se.code(), std::make_error_code(std::errc::invalid_argument));
+
+	std::filesystem::remove(TEST_SNAPSHOT);
+}
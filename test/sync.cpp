@@ -145,3 +145,695 @@ TEST(TestSYNC, DirMonitorDestruction)
 
 	dir.create_file(TEST_FILE1);
 }
+
+class counting_resource
+	: public std::pmr::memory_resource
+{
+public:
+	std::size_t allocations = 0;
+
+private:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		++allocations;
+
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override
+	{
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+TEST(TestSYNC, MemoryResource)
+{
+	directory dir(TEST_DIR1);
+	counting_resource resource;
+
+	{
+		services::path_monitor pm(io_context, "Path Monitor", &resource);
+		std::system_error se;
+		pm.add_path(TEST_DIR1, se);
+
+		EXPECT_EQ(se.code(), std::error_code());
+
+		dir.create_file(TEST_FILE1);
+
+		services::path_monitor_event ev = pm.monitor(se);
+
+		EXPECT_EQ(se.code(), std::error_code());
+		EXPECT_EQ(ev.path, TEST_FILE1);
+	}
+
+	EXPECT_GT(resource.allocations, 0u);
+}
+
+TEST(TestSYNC, WatchBudget)
+{
+	directory dir1(TEST_DIR1);
+	directory dir2(TEST_DIR2);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+
+	pm.set_watch_budget(1, std::chrono::milliseconds(20), se);
+	EXPECT_EQ(se.code(), std::error_code());
+
+	pm.add_path(TEST_DIR1, se);
+	EXPECT_EQ(se.code(), std::error_code());
+	pm.add_path(TEST_DIR2, se);
+	EXPECT_EQ(se.code(), std::error_code());
+
+	auto stats = pm.stats();
+	EXPECT_EQ(stats.watches, 1u);
+	EXPECT_EQ(stats.polled_watches, 1u);
+	EXPECT_EQ(stats.evictions, 1u);
+
+	// Changes to the demoted directory are picked up by polling.
+	dir1.create_file(TEST_FILE1);
+
+	services::path_monitor_event ev = pm.monitor(se);
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(ev.parent_path, TEST_DIR1);
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::added));
+
+	// The busy directory was promoted in place of the idle one.
+	stats = pm.stats();
+	EXPECT_EQ(stats.watches, 1u);
+	EXPECT_EQ(stats.polled_watches, 1u);
+	EXPECT_EQ(stats.promotions, 1u);
+
+	dir1.remove_file(TEST_FILE1);
+
+	ev = pm.monitor(se);
+	EXPECT_EQ(ev.parent_path, TEST_DIR1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::removed));
+}
+
+TEST(TestSYNC, DeletedDirectoryReleasesWatch)
+{
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+
+	{
+		directory dir(TEST_DIR1);
+
+		pm.add_path(TEST_DIR1, se);
+		EXPECT_EQ(se.code(), std::error_code());
+		EXPECT_EQ(pm.stats().watches, 1u);
+	}
+
+	for (int i = 0; i < 100 and pm.stats().watches; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	EXPECT_EQ(pm.stats().watches, 0u);
+}
+
+TEST(TestSYNC, IoUringReadPath)
+{
+	directory dir(TEST_DIR1);
+
+	boost::asio::io_context uring_io_context;
+	std::system_error se;
+
+	boost::asio::use_service<services::path_monitor_service<>>(uring_io_context).enable_io_uring(se);
+
+	if (se.code())
+		GTEST_SKIP() << se.what();
+
+	services::path_monitor pm(uring_io_context, "Path Monitor");
+	pm.add_path(TEST_DIR1, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	dir.create_file(TEST_FILE1);
+	dir.remove_file(TEST_FILE1);
+
+	services::path_monitor_event ev = pm.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(ev.parent_path, TEST_DIR1);
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::added));
+
+	ev = pm.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::removed));
+}
+
+TEST(TestSYNC, TailFile)
+{
+	directory dir(TEST_DIR1);
+	dir.append_file(TEST_FILE1, "old\n");
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	services::watch_options options;
+	options.tail = true;
+
+	// The directory helper changes the working directory while writing.
+	pm.add_path(std::filesystem::absolute(TEST_DIR1), options, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	// Appended bytes are delivered from the size the file had when added.
+	dir.append_file(TEST_FILE1, "new\n");
+
+	services::path_monitor_event ev = pm.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::modified));
+	ASSERT_TRUE(ev.data);
+	EXPECT_EQ(*ev.data, "new\n");
+	EXPECT_EQ(ev.offset, 4u);
+
+	// A truncated file is read again from its start.
+	std::filesystem::resize_file(std::filesystem::path(TEST_DIR1) / TEST_FILE1, 0);
+	dir.append_file(TEST_FILE1, "x");
+
+	ev = pm.monitor(se);
+
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::modified));
+	ASSERT_TRUE(ev.data);
+	EXPECT_EQ(*ev.data, "x");
+	EXPECT_EQ(ev.offset, 0u);
+
+	// Rotation: bytes written before the rename arrive with the modified or
+	// the renamed_old_name event, and the new file is read from its start.
+	dir.append_file(TEST_FILE1, "last\n");
+	dir.rename_file(TEST_FILE1, TEST_FILE2);
+	dir.append_file(TEST_FILE1, "first\n");
+
+	std::string rotated;
+
+	do {
+		ev = pm.monitor(se);
+
+		EXPECT_EQ(se.code(), std::error_code());
+
+		if (ev.data)
+			rotated += *ev.data;
+	} while (ev.event != services::path_monitor_event::type::renamed_old_name);
+
+	EXPECT_EQ(rotated, "last\n");
+
+	ev = pm.monitor(se);
+
+	EXPECT_EQ(ev.path, TEST_FILE2);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::renamed_new_name));
+
+	ev = pm.monitor(se);
+
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::added));
+
+	ev = pm.monitor(se);
+
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::modified));
+	ASSERT_TRUE(ev.data);
+	EXPECT_EQ(*ev.data, "first\n");
+	EXPECT_EQ(ev.offset, 0u);
+}
+
+TEST(TestSYNC, EventMetadata)
+{
+	directory dir(TEST_DIR1);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	pm.add_path(std::filesystem::absolute(TEST_DIR1), se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	std::filesystem::create_directory(std::filesystem::path(TEST_DIR1) / TEST_DIR2);
+	dir.append_file(TEST_FILE1, "data");
+
+	services::path_monitor_event ev = pm.monitor(se);
+
+	EXPECT_EQ(ev.path, TEST_DIR2);
+	EXPECT_TRUE(ev.is_directory);
+
+	// Every event of the file read so far is answered by one fetch.
+	std::vector<services::path_monitor_event> evs;
+
+	do {
+		evs.push_back(pm.monitor(se));
+	} while (evs.back().event != services::path_monitor_event::type::modified);
+
+	std::error_code ec;
+	auto m = evs.front().metadata(ec);
+
+	EXPECT_EQ(ec, std::error_code());
+	EXPECT_FALSE(evs.front().is_directory);
+	EXPECT_FALSE(m.is_directory);
+	EXPECT_EQ(m.size, 4u);
+
+	struct stat st;
+
+	ASSERT_EQ(::stat((std::filesystem::path(TEST_DIR1) / TEST_FILE1).c_str(), &st), 0);
+	EXPECT_EQ(m.inode, st.st_ino);
+
+	dir.append_file(TEST_FILE1, "more");
+
+	auto cached = evs.back().metadata(ec);
+
+	EXPECT_EQ(cached.size, 4u);
+	EXPECT_EQ(cached.inode, m.inode);
+
+	// A later event fetches again.
+	do {
+		ev = pm.monitor(se);
+	} while (ev.event != services::path_monitor_event::type::modified);
+
+	EXPECT_EQ(ev.metadata(ec).size, 8u);
+}
+
+TEST(TestSYNC, FileIdentity)
+{
+	directory dir1(TEST_DIR1);
+	directory dir2(TEST_DIR2);
+	dir1.append_file(TEST_FILE1, "data");
+
+	auto path1 = std::filesystem::absolute(TEST_DIR1);
+	auto path2 = std::filesystem::absolute(TEST_DIR2);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	services::watch_options options;
+	options.identity = true;
+	pm.add_path(path1, options, se);
+	pm.add_path(path2, options, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	dir1.append_file(TEST_FILE1, "more");
+
+	services::path_monitor_event ev = pm.monitor(se);
+
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::modified));
+
+	auto id = ev.file_id;
+
+	EXPECT_NE(id, 0u);
+
+	// A move between watched directories keeps the identifier.
+	std::filesystem::rename(path1 / TEST_FILE1, path2 / TEST_FILE2);
+
+	services::path_monitor_event from = pm.monitor(se);
+	services::path_monitor_event to = pm.monitor(se);
+
+	EXPECT_EQ(static_cast<int>(from.event), static_cast<int>(services::path_monitor_event::type::renamed_old_name));
+	EXPECT_EQ(static_cast<int>(to.event), static_cast<int>(services::path_monitor_event::type::renamed_new_name));
+	EXPECT_EQ(from.parent_path, path1);
+	EXPECT_EQ(to.parent_path, path2);
+	EXPECT_NE(from.cookie, 0u);
+	EXPECT_EQ(from.cookie, to.cookie);
+	EXPECT_EQ(from.file_id, id);
+	EXPECT_EQ(to.file_id, id);
+
+	dir1.create_file(TEST_FILE1);
+
+	ev = pm.monitor(se);
+
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::added));
+	EXPECT_NE(ev.file_id, 0u);
+	EXPECT_NE(ev.file_id, id);
+
+	dir2.remove_file(TEST_FILE2);
+
+	ev = pm.monitor(se);
+
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::removed));
+	EXPECT_EQ(ev.file_id, id);
+}
+
+TEST(TestSYNC, PriorityLanes)
+{
+	directory bulk(TEST_DIR1);
+	directory config(TEST_DIR2);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	services::watch_options options;
+	options.priority = services::watch_priority::low;
+	pm.add_path(TEST_DIR1, options, se);
+	options.priority = services::watch_priority::high;
+	pm.add_path(TEST_DIR2, options, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	for (int i = 0; i < 20; ++i)
+		bulk.create_file("bulk" + std::to_string(i));
+
+	config.create_file(TEST_FILE1);
+
+	while (pm.stats().queued_events < 21)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	EXPECT_EQ(pm.stats().queued_by_priority[0], 20u);
+	EXPECT_EQ(pm.stats().queued_by_priority[2], 1u);
+
+	services::path_monitor_event ev = pm.monitor(se);
+
+	EXPECT_EQ(ev.parent_path, TEST_DIR2);
+	EXPECT_EQ(ev.path, TEST_FILE1);
+}
+
+TEST(TestSYNC, RecursiveExclusion)
+{
+	directory dir(TEST_DIR1);
+	auto root = std::filesystem::absolute(TEST_DIR1);
+
+	std::filesystem::create_directories(root / "src" / "gen");
+	std::filesystem::create_directories(root / "node_modules" / "pkg");
+	std::filesystem::create_directories(root / "build");
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	services::watch_options options;
+	options.recursive = true;
+	options.exclude = { "node_modules", "build", "src/gen" };
+	pm.add_path(root, options, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(pm.stats().watches, 2u);
+
+	// A new directory is watched and its early entries reported.
+	std::filesystem::create_directory(root / "new");
+	std::ofstream(root / "new" / TEST_FILE1).close();
+
+	services::path_monitor_event ev;
+
+	do {
+		ev = pm.monitor(se);
+		ASSERT_EQ(se.code(), std::error_code());
+	} while (ev.parent_path != root / "new" or ev.path != TEST_FILE1);
+
+	EXPECT_EQ(pm.stats().watches, 3u);
+
+	// A new excluded directory is reported but not watched.
+	std::filesystem::create_directory(root / "new" / "node_modules");
+	std::ofstream(root / "new" / "node_modules" / TEST_FILE1).close();
+	std::ofstream(root / TEST_FILE2).close();
+
+	do {
+		ev = pm.monitor(se);
+		ASSERT_EQ(se.code(), std::error_code());
+		EXPECT_EQ(ev.parent_path.string().find("node_modules"), std::string::npos);
+	} while (ev.path != TEST_FILE2);
+
+	EXPECT_EQ(pm.stats().watches, 3u);
+}
+
+TEST(TestSYNC, ReadyFile)
+{
+	directory dir(TEST_DIR1);
+	auto root = std::filesystem::absolute(TEST_DIR1);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	services::watch_options options;
+	options.ready = true;
+	options.settle = std::chrono::milliseconds(200);
+	pm.add_path(root, options, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	auto next_ready = [&]() {
+		services::path_monitor_event ev;
+
+		do {
+			ev = pm.monitor(se);
+			EXPECT_EQ(se.code(), std::error_code());
+		} while (ev.event != services::path_monitor_event::type::ready);
+
+		return ev;
+	};
+
+	// Closed after writing.
+	dir.append_file(TEST_FILE1, "complete");
+
+	EXPECT_EQ(next_ready().path, TEST_FILE1);
+
+	// Held open, reported once quiet for the settle period.
+	std::ofstream ofs(root / TEST_FILE2);
+	ofs << "partial" << std::flush;
+
+	auto start = std::chrono::steady_clock::now();
+	auto ev = next_ready();
+
+	EXPECT_EQ(ev.path, TEST_FILE2);
+	EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(150));
+
+	// Closing without further writes is not reported again.
+	ofs.close();
+	std::ofstream(root / "written").close();
+
+	do {
+		ev = pm.monitor(se);
+		EXPECT_NE(ev.path, TEST_FILE2);
+	} while (ev.path != "written");
+
+	EXPECT_EQ(next_ready().path, "written");
+}
+
+TEST(TestSYNC, ReadyTailRename)
+{
+	directory dir(TEST_DIR1);
+	directory staging(TEST_DIR2);
+	auto root = std::filesystem::absolute(TEST_DIR1);
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	services::watch_options options;
+	options.ready = true;
+	options.tail = true;
+	pm.add_path(root, options, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	// Written elsewhere and renamed in place: reported ready after the
+	// rename, and only later appends are tailed.
+	staging.append_file(TEST_FILE1, "moved\n");
+	std::filesystem::rename(std::filesystem::absolute(TEST_DIR2) / TEST_FILE1, root / TEST_FILE1);
+
+	services::path_monitor_event ev = pm.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::renamed_new_name));
+
+	ev = pm.monitor(se);
+
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::ready));
+
+	dir.append_file(TEST_FILE1, "more\n");
+
+	do {
+		ev = pm.monitor(se);
+		EXPECT_EQ(se.code(), std::error_code());
+	} while (ev.event != services::path_monitor_event::type::modified);
+
+	ASSERT_TRUE(ev.data);
+	EXPECT_EQ(*ev.data, "more\n");
+	EXPECT_EQ(ev.offset, 6u);
+}
+
+TEST(TestSYNC, ColumnarBatch)
+{
+	directory dir(TEST_DIR1);
+	auto root = std::filesystem::absolute(TEST_DIR1);
+
+	struct collector
+		: services::event_batch_sink
+	{
+		std::mutex mutex;
+		std::vector<services::path_monitor_event> events;
+
+		void consume(const services::event_batch &batch) override
+		{
+			std::unique_lock<std::mutex> lk(mutex);
+
+			for (std::size_t i = 0; i < batch.size(); ++i)
+				events.push_back(batch.event(i));
+		}
+	};
+
+	struct counter
+		: services::path_monitor_event_sink
+	{
+		std::atomic<std::size_t> events{ 0 };
+
+		void consume(const services::path_monitor_event &) override
+		{
+			++events;
+		}
+	};
+
+	auto sink = std::make_shared<collector>();
+	auto observer = std::make_shared<counter>();
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	pm.add_path(root, se);
+	pm.add_sink(observer);
+	pm.set_batch_sink(sink, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	dir.create_file(TEST_FILE1);
+	dir.append_file(TEST_FILE1, "data");
+	dir.create_file(TEST_FILE2);
+
+	for (;;) {
+		std::unique_lock<std::mutex> lk(sink->mutex);
+
+		if (sink->events.size() >= 3)
+			break;
+
+		lk.unlock();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	EXPECT_EQ(sink->events[0].parent_path, root);
+	EXPECT_EQ(sink->events[0].path, TEST_FILE1);
+	EXPECT_EQ(sink->events[0].event, services::path_monitor_event::type::added);
+	EXPECT_EQ(sink->events[1].path, TEST_FILE1);
+	EXPECT_EQ(sink->events[1].event, services::path_monitor_event::type::modified);
+	EXPECT_EQ(sink->events.back().path, TEST_FILE2);
+	EXPECT_EQ(sink->events.back().event, services::path_monitor_event::type::added);
+	EXPECT_EQ(pm.stats().queued_events, 0u);
+
+	// Event sinks keep observing events in batch mode.
+	EXPECT_EQ(observer->events, sink->events.size());
+}
+
+TEST(TestSYNC, DirectoryIndex)
+{
+	directory dir(TEST_DIR1);
+	auto root = std::filesystem::absolute(TEST_DIR1);
+
+	dir.create_file(TEST_FILE1);
+	std::filesystem::create_directory(root / "sub");
+
+	services::path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	services::watch_options options;
+	options.recursive = true;
+	options.index = true;
+	pm.add_path(root, options, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	// Listings are published once a whole read has been queued.
+	auto wait_listed = [&](const std::filesystem::path &path, bool listed) {
+		for (int i = 0; i < 1000; ++i) {
+			std::system_error e;
+			auto l = pm.list_directory(path.parent_path(), e);
+
+			if ((l and l->find(path.filename().string())) == listed)
+				return;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	};
+
+	auto listing = pm.list_directory(root, se);
+
+	ASSERT_EQ(se.code(), std::error_code());
+	ASSERT_EQ(listing->entries.size(), 2u);
+	EXPECT_NE(listing->find(TEST_FILE1), nullptr);
+	ASSERT_NE(listing->find("sub"), nullptr);
+	EXPECT_TRUE(listing->find("sub")->is_directory);
+
+	// Listings follow the events once they have been read.
+	dir.create_file(TEST_FILE2);
+	dir.rename_file(TEST_FILE1, "renamed");
+	std::ofstream(root / "sub" / TEST_FILE1).close();
+	std::filesystem::create_directory(root / "new");
+
+	services::path_monitor_event ev;
+
+	do {
+		ev = pm.monitor(se);
+		ASSERT_EQ(se.code(), std::error_code());
+	} while (ev.path != "new");
+
+	wait_listed(root / "new", true);
+	listing = pm.list_directory(root, se);
+
+	ASSERT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(listing->find(TEST_FILE1), nullptr);
+	EXPECT_NE(listing->find(TEST_FILE2), nullptr);
+	EXPECT_NE(listing->find("renamed"), nullptr);
+	EXPECT_NE(listing->find("new"), nullptr);
+
+	listing = pm.list_directory(root / "sub", se);
+
+	ASSERT_EQ(se.code(), std::error_code());
+	ASSERT_EQ(listing->entries.size(), 1u);
+	EXPECT_EQ(listing->entries[0].name, TEST_FILE1);
+
+	pm.list_directory(root / "new", se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	// A removed directory is no longer indexed.
+	std::filesystem::remove(root / "sub" / TEST_FILE1);
+	std::filesystem::remove(root / "sub");
+
+	do {
+		ev = pm.monitor(se);
+		ASSERT_EQ(se.code(), std::error_code());
+	} while (ev.path != "sub" or ev.event != services::path_monitor_event::type::removed);
+
+	wait_listed(root / "sub", false);
+	pm.list_directory(root / "sub", se);
+
+	EXPECT_EQ(se.code(), std::errc::no_such_file_or_directory);
+	EXPECT_EQ(pm.list_directory(root, se)->find("sub"), nullptr);
+}
+
+static_assert(std::is_same<services::path_monitor,
+	      services::basic_policy_path_monitor<services::default_path_monitor_policy>>::value,
+	      "the default policies configure path_monitor");
+
+TEST(TestSYNC, SingleThreadedPolicy)
+{
+	directory dir(TEST_DIR1);
+	auto root = std::filesystem::absolute(TEST_DIR1);
+
+	services::single_threaded_path_monitor pm(io_context, "Path Monitor");
+	std::system_error se;
+	pm.add_path(root, se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	dir.create_file(TEST_FILE1);
+	dir.create_file(TEST_FILE2);
+
+	// Events are read on this thread while it waits, in arrival order.
+	auto ev = pm.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(ev.parent_path, root);
+	EXPECT_EQ(ev.path, TEST_FILE1);
+	EXPECT_EQ(ev.event, services::path_monitor_event::type::added);
+
+	ev = pm.monitor(se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(ev.path, TEST_FILE2);
+	EXPECT_EQ(ev.event, services::path_monitor_event::type::added);
+
+	EXPECT_EQ(pm.stats().watches, 1u);
+}
@@ -0,0 +1,428 @@
+//
+// Copyright (c) 2018 Edward Kigwana (ekigwana at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <new>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "path_monitor/handler_allocator.hpp"
+#include "path_monitor/path_monitor_set.hpp"
+#include "path_monitor/synthetic/synthetic_path_monitor_impl.hpp"
+
+#define TEST_TRACE "path_monitor_test.trace"
+
+boost::asio::io_context io_context;
+
+namespace {
+
+std::atomic<std::size_t> allocations{ 0 };
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+	++allocations;
+
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+namespace {
+
+bool same(const services::path_monitor_event &a, const services::path_monitor_event &b)
+{
+	return a.parent_path == b.parent_path and a.path == b.path and a.event == b.event;
+}
+
+} // namespace
+
+TEST(TestSYNTHETIC, Generator)
+{
+	services::synthetic_path_monitor pm(io_context, "Synthetic");
+	std::size_t count = 200000;
+
+	// A bounded queue makes the producer run at the consumer's pace.
+	pm.get_implementation()->set_queue_limit(4096);
+
+	std::thread producer([&pm, count]() {
+		EXPECT_EQ(pm.get_implementation()->generate(services::synthetic_event_generator(42), count), count);
+	});
+
+	services::synthetic_event_generator expected(42);
+	std::system_error se;
+
+	for (std::size_t i = 0; i < count; ++i) {
+		auto ev = pm.monitor(se);
+
+		EXPECT_EQ(se.code(), std::error_code());
+		ASSERT_TRUE(same(ev, expected())) << "event " << i;
+	}
+
+	producer.join();
+
+	EXPECT_EQ(pm.stats().queued_events, 0u);
+}
+
+TEST(TestSYNTHETIC, TraceReplay)
+{
+	std::system_error se;
+
+	{
+		services::synthetic_path_monitor pm(io_context, "Synthetic");
+		auto recorder = std::make_shared<services::synthetic_trace_recorder>(TEST_TRACE);
+
+		pm.add_sink(recorder);
+		pm.get_implementation()->generate(services::synthetic_event_generator(7), 5000);
+		pm.get_implementation()->inject(services::path_monitor_event("/a b", "c d.txt",
+			services::path_monitor_event::type::renamed_new_name));
+		recorder->flush();
+	}
+
+	services::synthetic_path_monitor pm(io_context, "Synthetic");
+
+	EXPECT_EQ(pm.get_implementation()->replay(TEST_TRACE, se), 5001u);
+	EXPECT_EQ(se.code(), std::error_code());
+
+	services::synthetic_event_generator expected(7);
+
+	for (std::size_t i = 0; i < 5000; ++i)
+		ASSERT_TRUE(same(pm.monitor(se), expected())) << "event " << i;
+
+	auto ev = pm.monitor(se);
+
+	EXPECT_EQ(ev.parent_path, "/a b");
+	EXPECT_EQ(ev.path, "c d.txt");
+	EXPECT_EQ(static_cast<int>(ev.event), static_cast<int>(services::path_monitor_event::type::renamed_new_name));
+
+	std::filesystem::remove(TEST_TRACE);
+}
+
+TEST(TestSYNTHETIC, AsyncDispatch)
+{
+	services::synthetic_path_monitor pm(io_context, "Synthetic");
+	std::size_t count = 10000;
+	std::size_t handled = 0;
+
+	pm.get_implementation()->generate(services::synthetic_event_generator(1), count);
+
+	std::promise<void> done;
+	std::function<void(const std::system_error &, const services::path_monitor_event &)> handler;
+
+	handler = [&](const std::system_error &se, const services::path_monitor_event &) {
+		EXPECT_EQ(se.code(), std::error_code());
+
+		if (++handled < count)
+			pm.async_monitor(handler);
+		else
+			done.set_value();
+	};
+
+	pm.async_monitor(handler);
+
+	EXPECT_EQ(done.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+	EXPECT_EQ(handled, count);
+}
+
+/// Handler re-arming async_monitor() until count events were handled,
+/// counting the allocations made once the chain is warm.
+struct counting_handler
+{
+	services::synthetic_path_monitor *pm;
+	services::handler_memory *memory;
+	std::size_t *handled;
+	std::size_t count;
+	std::size_t *steady_allocations;
+	std::promise<void> *done;
+
+	void operator()(const std::system_error &se, const services::path_monitor_event &)
+	{
+		EXPECT_EQ(se.code(), std::error_code());
+
+		if (++*handled == 100)
+			*steady_allocations = allocations;
+
+		if (*handled < count) {
+			pm->async_monitor(services::make_recycling_handler(*memory, *this));
+		} else {
+			*steady_allocations = allocations - *steady_allocations;
+			done->set_value();
+		}
+	}
+};
+
+TEST(TestSYNTHETIC, RecyclingAllocation)
+{
+	services::synthetic_path_monitor pm(io_context, "Synthetic");
+	services::handler_memory memory;
+	std::size_t count = 10000;
+	std::size_t handled = 0;
+	std::size_t steady_allocations = 0;
+	std::promise<void> done;
+	auto future = done.get_future();
+
+	pm.get_implementation()->generate(services::synthetic_event_generator(3), count);
+
+	pm.async_monitor(services::make_recycling_handler(memory,
+		counting_handler{ &pm, &memory, &handled, count, &steady_allocations, &done }));
+
+	EXPECT_EQ(future.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+	EXPECT_EQ(handled, count);
+	EXPECT_EQ(steady_allocations, 0u);
+}
+
+TEST(TestSYNTHETIC, Subscription)
+{
+	services::synthetic_path_monitor pm(io_context, "Synthetic");
+	std::size_t count = 10000;
+	std::size_t handled = 0;
+	std::promise<void> received;
+	std::promise<void> canceled;
+
+	pm.get_implementation()->generate(services::synthetic_event_generator(5), count / 2);
+
+	auto subscription = pm.subscribe([&](const std::system_error &se, services::path_monitor_event &&) {
+		if (se.code() == std::errc::operation_canceled) {
+			canceled.set_value();
+
+			return;
+		}
+
+		if (++handled == count)
+			received.set_value();
+	});
+
+	// Events queued while the subscription waits wake it up.
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	pm.get_implementation()->generate(services::synthetic_event_generator(6), count / 2);
+
+	EXPECT_EQ(received.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+	EXPECT_TRUE(subscription.active());
+
+	subscription.cancel();
+
+	EXPECT_EQ(canceled.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+	EXPECT_FALSE(subscription.active());
+	EXPECT_EQ(handled, count);
+
+	// Stopping the monitor ends a subscription too.
+	std::promise<void> stopped;
+
+	subscription = pm.subscribe([&](const std::system_error &se, const services::path_monitor_event &) {
+		if (se.code() == std::errc::operation_canceled)
+			stopped.set_value();
+	});
+
+	pm.stop();
+
+	EXPECT_EQ(stopped.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+	EXPECT_FALSE(subscription.active());
+}
+
+TEST(TestSYNTHETIC, MonitorSet)
+{
+	services::synthetic_path_monitor noisy(io_context, "Noisy");
+	services::synthetic_path_monitor quiet1(io_context, "Quiet 1");
+	services::synthetic_path_monitor quiet2(io_context, "Quiet 2");
+	services::basic_path_monitor_set<services::synthetic_path_monitor> set(2);
+	std::vector<services::basic_path_monitor_set<services::synthetic_path_monitor>::entry> events;
+	std::system_error se;
+
+	set.add(noisy);
+	set.add(quiet1);
+	set.add(quiet2);
+
+	EXPECT_EQ(set.wait(events, 10, std::chrono::milliseconds(20), se), 0u);
+	EXPECT_EQ(se.code(), std::errc::timed_out);
+
+	noisy.get_implementation()->generate(services::synthetic_event_generator(1), 1000);
+	quiet1.get_implementation()->generate(services::synthetic_event_generator(2), 2);
+	quiet2.get_implementation()->generate(services::synthetic_event_generator(3), 2);
+
+	// Every ready monitor is served before the noisy one comes again.
+	EXPECT_EQ(set.wait(events, 6, std::chrono::seconds(10), se), 6u);
+	EXPECT_EQ(se.code(), std::error_code());
+
+	for (std::size_t i = 0; i < events.size(); ++i)
+		EXPECT_EQ(events[i].monitor, i < 2 ? &noisy : i < 4 ? &quiet1 : &quiet2) << "event " << i;
+
+	events.clear();
+
+	EXPECT_EQ(set.wait(events, 100, std::chrono::seconds(10), se), 100u);
+
+	for (const auto &e : events)
+		EXPECT_EQ(e.monitor, &noisy);
+
+	// A stopped monitor leaves the set.
+	quiet1.stop();
+	events.clear();
+	set.wait(events, 100, std::chrono::seconds(10), se);
+
+	EXPECT_EQ(set.size(), 2u);
+
+	while (set.wait(events, 100, std::chrono::steady_clock::duration::zero(), se))
+		;
+
+	// A monitor stopping yields no events; waiting goes on for the others.
+	quiet2.stop();
+
+	std::thread producer([&noisy]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		noisy.get_implementation()->generate(services::synthetic_event_generator(4), 1);
+	});
+
+	events.clear();
+
+	EXPECT_EQ(set.wait(events, 100, std::chrono::steady_clock::duration::max(), se), 1u);
+	EXPECT_EQ(se.code(), std::error_code());
+	EXPECT_EQ(set.size(), 1u);
+
+	producer.join();
+}
+
+TEST(TestSYNTHETIC, TreeQuiescence)
+{
+	boost::asio::io_context ctx;
+	auto work = boost::asio::make_work_guard(ctx);
+	std::thread runner([&ctx]() { ctx.run(); });
+
+	services::synthetic_path_monitor pm(ctx, "Synthetic");
+	auto start = std::chrono::steady_clock::now();
+	std::atomic<std::size_t> quiet{ 0 };
+	std::promise<std::chrono::steady_clock::duration> tree_quiet;
+	std::promise<std::chrono::steady_clock::duration> other_quiet;
+	std::promise<std::error_code> canceled;
+
+	pm.async_wait_quiet("/synthetic", std::chrono::milliseconds(100), [&](const std::system_error &se) {
+		EXPECT_EQ(se.code(), std::error_code());
+		tree_quiet.set_value(std::chrono::steady_clock::now() - start);
+	});
+
+	for (int i = 0; i < 1000; ++i) {
+		pm.async_wait_quiet("/synthetic/", std::chrono::milliseconds(100), [&](const std::system_error &se) {
+			if (!se.code())
+				++quiet;
+		});
+	}
+
+	pm.async_wait_quiet("/other", std::chrono::milliseconds(50), [&](const std::system_error &) {
+		other_quiet.set_value(std::chrono::steady_clock::now() - start);
+	});
+
+	// Changes below the tree for 300 ms keep it from being quiet.
+	for (int i = 0; i < 30; ++i) {
+		pm.get_implementation()->inject(services::path_monitor_event("/synthetic/d1/d2", "f",
+			services::path_monitor_event::type::modified));
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	auto other = other_quiet.get_future();
+	auto tree = tree_quiet.get_future();
+
+	ASSERT_EQ(other.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+	ASSERT_EQ(tree.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+	EXPECT_LT(other.get(), std::chrono::milliseconds(250));
+	EXPECT_GE(tree.get(), std::chrono::milliseconds(350));
+
+	while (quiet < 1000)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	// Stopping the monitor cancels pending waits.
+	pm.async_wait_quiet("/synthetic", std::chrono::hours(1), [&](const std::system_error &se) {
+		canceled.set_value(se.code());
+	});
+
+	pm.stop();
+
+	auto code = canceled.get_future();
+
+	ASSERT_EQ(code.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+	EXPECT_EQ(code.get(), std::errc::operation_canceled);
+
+	work.reset();
+	runner.join();
+}
+
+TEST(TestSYNTHETIC, Unsupported)
+{
+	services::synthetic_path_monitor pm(io_context, "Synthetic");
+	std::system_error se;
+
+	pm.add_path("/synthetic/d0", se);
+
+	EXPECT_EQ(se.code(), std::error_code());
+
+	pm.set_watch_budget(1, std::chrono::seconds(1), se);
+
+	EXPECT_EQ(se.code(), std::errc::operation_not_supported);
+
+	// Destruction releases a blocked consumer.
+	std::thread consumer([&pm]() {
+		std::system_error se;
+
+		pm.monitor(se);
+
+		EXPECT_EQ(se.code(), std::errc::operation_canceled);
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	pm.stop();
+	consumer.join();
+}
+
+TEST(TestSYNTHETIC, PriorityLanes)
+{
+	services::synthetic_path_monitor pm(io_context, "Synthetic");
+	auto &impl = pm.get_implementation();
+
+	impl->generate(services::synthetic_event_generator(3), 1000, services::watch_priority::low);
+	impl->generate(services::synthetic_event_generator(4), 200, services::watch_priority::high);
+	impl->inject(services::path_monitor_event("/config", "app.conf", services::path_monitor_event::type::modified),
+		     services::watch_priority::high);
+
+	auto stats = pm.stats();
+
+	EXPECT_EQ(stats.queued_events, 1201u);
+	EXPECT_EQ(stats.queued_by_priority[0], 1000u);
+	EXPECT_EQ(stats.queued_by_priority[1], 0u);
+	EXPECT_EQ(stats.queued_by_priority[2], 201u);
+
+	// High priority events overtake the backlog; the low lane is still
+	// served once every 65 events.
+	std::system_error se;
+	services::synthetic_event_generator high(4);
+	services::synthetic_event_generator low(3);
+
+	for (std::size_t i = 0; i < 204; ++i) {
+		auto ev = pm.monitor(se);
+
+		if (i % 65 == 64)
+			ASSERT_TRUE(same(ev, low())) << "event " << i;
+		else if (i < 203)
+			ASSERT_TRUE(same(ev, high())) << "event " << i;
+		else
+			EXPECT_EQ(ev.path, "app.conf");
+	}
+
+	EXPECT_EQ(pm.stats().queued_by_priority[0], 997u);
+}